@@ -0,0 +1,155 @@
+// TOPIC: False Sharing And Cache Line Padding
+
+// NOTES:
+// 0. The CPU does not move single bytes between the cores caches, it moves whole cache lines (64 bytes).
+// 1. OddSum/EvenSum in 1-IntroToThread.cpp and X/Y in 6-StdTryLock.cpp are declared next to each other,
+//    so they sit in the same cache line. Every time one thread writes its own variable, the line is
+//    taken away from the other core, even though the threads never touch the same variable.
+//    This is called false sharing, the threads are slower than if they were run one after another.
+// 2. The fix is to give every variable written by a different thread its own cache line:
+//    a. CachePadded<T>   : wraps a value and aligns/pads it to a full cache line.
+//    b. PerThreadSlots<T>: an array with one CachePadded slot per thread, for per thread
+//                          counters/partial sums which are combined at the end.
+//    c. AlignedNew / AlignedDelete and CacheAlignedAllocator<T>: heap memory starting at a
+//       cache line boundary, so a padded object really starts at the beginning of a line
+//       (before C++17, new ignores an alignas bigger than 16 bytes).
+// 3. The cost: padding wastes memory (64 bytes for an 8 bytes counter), use it only for data written
+//    by several threads.
+
+// To build: g++ -std=c++17 -O2 -pthread 12-FalseSharing.cpp
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <chrono>
+#include <new>
+#include <cstdlib>
+#include <cstddef>
+using namespace std;
+using namespace std::chrono;
+typedef long long int  ull;
+
+// 64 bytes on x86 and most ARM cores
+constexpr size_t CacheLineSize = 64;
+
+// heap memory aligned to a cache line
+void* AlignedNew(size_t size, size_t alignment = CacheLineSize) {
+	void* p = nullptr;
+	if (posix_memalign(&p, alignment, size) != 0)
+		throw std::bad_alloc();
+	return p;
+}
+
+void AlignedDelete(void* p) {
+	free(p);
+}
+
+// allocator for standard containers, every buffer starts at a cache line
+template <typename T>
+struct CacheAlignedAllocator {
+	typedef T value_type;
+
+	CacheAlignedAllocator() = default;
+	template <typename U> CacheAlignedAllocator(const CacheAlignedAllocator<U>&) {}
+
+	T* allocate(size_t n) { return static_cast<T*>(AlignedNew(n * sizeof(T))); }
+	void deallocate(T* p, size_t) { AlignedDelete(p); }
+
+	template <typename U> bool operator==(const CacheAlignedAllocator<U>&) const { return true; }
+	template <typename U> bool operator!=(const CacheAlignedAllocator<U>&) const { return false; }
+};
+
+// one value alone in its cache line
+template <typename T>
+struct alignas(CacheLineSize) CachePadded {
+	T value;
+
+	CachePadded() : value() {}
+	explicit CachePadded(const T& v) : value(v) {}
+
+	T& operator*() { return value; }
+	T* operator->() { return &value; }
+};
+
+// one padded slot per thread, slot i is written only by thread i
+template <typename T>
+class PerThreadSlots {
+public:
+	explicit PerThreadSlots(size_t threads) : slots(threads) {}
+
+	T& operator[](size_t thread) { return slots[thread].value; }
+	size_t size() const { return slots.size(); }
+
+	// combine all the slots at the end
+	template <typename Op>
+	T Combine(T identity, Op op) const {
+		for (const CachePadded<T>& s : slots)
+			identity = op(identity, s.value);
+		return identity;
+	}
+
+private:
+	std::vector<CachePadded<T>, CacheAlignedAllocator<CachePadded<T>>> slots;
+};
+
+// same work as findEven/findOdd in 1-IntroToThread.cpp, every iteration writes the sum to memory
+// (a relaxed atomic load + store is a plain memory write which the compiler can't keep in a register)
+void addTo(std::atomic<ull>* sum, ull start, ull end) {
+	for (ull i = start; i <= end; ++i)
+		sum->store(sum->load(std::memory_order_relaxed) + i, std::memory_order_relaxed);
+}
+
+struct Unpadded {
+	std::atomic<ull> OddSum{0};
+	std::atomic<ull> EvenSum{0};
+};
+
+struct Padded {
+	CachePadded<std::atomic<ull>> OddSum;
+	CachePadded<std::atomic<ull>> EvenSum;
+};
+
+double run(std::atomic<ull>& a, std::atomic<ull>& b, ull end) {
+	auto startTime = high_resolution_clock::now();
+	std::thread t1(addTo, &a, 0, end);
+	std::thread t2(addTo, &b, 0, end);
+	t1.join();
+	t2.join();
+	auto stopTime = high_resolution_clock::now();
+	return duration_cast<microseconds>(stopTime - startTime).count() / 1000.0;
+}
+
+int main() {
+	ull end = 200000000;
+
+	Unpadded unpadded;
+	Padded* padded = new (AlignedNew(sizeof(Padded))) Padded();
+
+	cout << "distance between the sums, unpadded: "
+	     << (char*)&unpadded.EvenSum - (char*)&unpadded.OddSum << " bytes, padded: "
+	     << (char*)&padded->EvenSum - (char*)&padded->OddSum << " bytes" << endl;
+
+	double sharedMs = run(unpadded.OddSum, unpadded.EvenSum, end);
+	double paddedMs = run(padded->OddSum.value, padded->EvenSum.value, end);
+
+	cout << "same cache line : " << sharedMs << " ms" << endl;
+	cout << "own cache lines : " << paddedMs << " ms" << endl;
+
+	// per thread slots: every thread counts in its own slot, the total is combined at the end
+	unsigned threads = std::thread::hardware_concurrency();
+	PerThreadSlots<ull> partial(threads);
+	std::vector<std::thread> workers;
+	for (unsigned t = 0; t < threads; ++t)
+		workers.emplace_back([&partial, t] {
+			for (int i = 0; i < 1000000; ++i)
+				++partial[t];
+		});
+	for (std::thread& w : workers)
+		w.join();
+	cout << "per thread slots total: " << partial.Combine(0, [](ull a, ull b) { return a + b; }) << endl;
+
+	padded->~Padded();
+	AlignedDelete(padded);
+	return 0;
+}
@@ -0,0 +1,420 @@
+// TOPIC: Work Stealing Thread Pool
+
+// NOTES:
+// 0. 2-ThreadCreation.cpp starts a new std::thread for every call. Creating and joining an OS thread
+//    costs tens of microseconds, much more than a small task itself.
+// 1. A thread pool creates its threads (workers) once, the tasks are then given to the running workers.
+//    ThreadPool pool;                       // one worker per core
+//    pool.Submit(fun, 10);                  // same callables as std::thread:
+//    pool.Submit([](int x){ ... }, 10);     // function pointer, lambda, functor,
+//    pool.Submit(Base(), 10);               // non-static member function (with the object pointer)
+//    pool.Submit(&Base::run, &b, 10);       // and static member function
+//    pool.Wait();                           // waits until all the submitted tasks are finished
+// 2. Work stealing: every worker has its own deque (Chase-Lev deque).
+//    a. The owner pushes and pops at the bottom without locks (last in first out, the data is still in cache).
+//    b. An idle worker steals from the top of another worker's deque (the oldest task, usually the biggest
+//       part of a split job), only the steal needs a compare and swap.
+//    c. Tasks submitted by a task (nested tasks) go to the worker's own deque, tasks submitted from
+//       outside the pool (main) go to a shared queue protected by a mutex.
+// 3. Idle workers first retry and yield for a while, then sleep on a condition variable,
+//    so an idle pool takes no cpu.
+// 4. An exception escaping a task calls std::terminate, same as an exception escaping a std::thread.
+// 5. Don't call Wait() from inside a task, the worker would wait for itself.
+
+// To build: g++ -std=c++17 -O2 -pthread 13-ThreadPool.cpp
+
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <deque>
+#include <tuple>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+using namespace std;
+using namespace std::chrono;
+typedef long long int  ull;
+
+// a task with its arguments, created by Submit, deleted by the worker after running it
+struct Task {
+	virtual ~Task() {}
+	virtual void Run() = 0;
+};
+
+template <typename F>
+struct TaskOf : Task {
+	F f;
+	explicit TaskOf(F&& fn) : f(std::move(fn)) {}
+	void Run() override { f(); }
+};
+
+// Chase-Lev deque (Le, Pop, Cohen, Zappa Nardelli: "Correct and Efficient Work-Stealing for Weak Memory Models")
+// Push/Pop only by the owner thread, Steal by any thread
+class ChaseLevDeque {
+public:
+	explicit ChaseLevDeque(int64_t capacity = 256) : top(0), bottom(0), array(new Array(capacity)) {}
+
+	~ChaseLevDeque() {
+		delete array.load(memory_order_relaxed);
+		for (Array* a : retired)
+			delete a;
+	}
+
+	void Push(Task* x) {
+		int64_t b = bottom.load(memory_order_relaxed);
+		int64_t t = top.load(memory_order_acquire);
+		Array* a = array.load(memory_order_relaxed);
+		if (b - t > a->capacity - 1) {
+			// full: copy into a twice bigger array, a thief may still read the old one so keep it
+			Array* bigger = a->Grow(b, t);
+			retired.push_back(a);
+			array.store(bigger, memory_order_release);
+			a = bigger;
+		}
+		a->Put(b, x);
+		atomic_thread_fence(memory_order_release);
+		bottom.store(b + 1, memory_order_relaxed);
+	}
+
+	Task* Pop() {
+		int64_t b = bottom.load(memory_order_relaxed) - 1;
+		Array* a = array.load(memory_order_relaxed);
+		bottom.store(b, memory_order_relaxed);
+		atomic_thread_fence(memory_order_seq_cst);
+		int64_t t = top.load(memory_order_relaxed);
+
+		if (t > b) {
+			// empty
+			bottom.store(b + 1, memory_order_relaxed);
+			return nullptr;
+		}
+		Task* x = a->Get(b);
+		if (t == b) {
+			// last task: race against the thieves
+			if (!top.compare_exchange_strong(t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+				x = nullptr;
+			bottom.store(b + 1, memory_order_relaxed);
+		}
+		return x;
+	}
+
+	Task* Steal() {
+		int64_t t = top.load(memory_order_acquire);
+		atomic_thread_fence(memory_order_seq_cst);
+		int64_t b = bottom.load(memory_order_acquire);
+		if (t >= b)
+			return nullptr;
+		Array* a = array.load(memory_order_acquire);
+		Task* x = a->Get(t);
+		if (!top.compare_exchange_strong(t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+			return nullptr;		// another thief or the owner took it
+		return x;
+	}
+
+	bool Empty() const {
+		return top.load(memory_order_acquire) >= bottom.load(memory_order_acquire);
+	}
+
+private:
+	struct Array {
+		int64_t capacity;
+		atomic<Task*>* slots;
+
+		explicit Array(int64_t c) : capacity(c), slots(new atomic<Task*>[c]) {}
+		~Array() { delete[] slots; }
+
+		Task* Get(int64_t i) const { return slots[i & (capacity - 1)].load(memory_order_relaxed); }
+		void Put(int64_t i, Task* x) { slots[i & (capacity - 1)].store(x, memory_order_relaxed); }
+
+		Array* Grow(int64_t b, int64_t t) const {
+			Array* a = new Array(capacity * 2);
+			for (int64_t i = t; i < b; ++i)
+				a->Put(i, Get(i));
+			return a;
+		}
+	};
+
+	alignas(64) atomic<int64_t> top;
+	alignas(64) atomic<int64_t> bottom;
+	atomic<Array*> array;
+	vector<Array*> retired;		// owner only, freed with the deque
+};
+
+class ThreadPool {
+public:
+	explicit ThreadPool(unsigned threads = thread::hardware_concurrency())
+		: workers(threads == 0 ? 1 : threads), stop(false), sleepers(0), pending(0), injectedSize(0) {
+		for (unsigned i = 0; i < workers.size(); ++i) {
+			workers[i].rng = 0x9E3779B9u * (i + 1);
+			workers[i].t = thread(&ThreadPool::WorkerLoop, this, i);
+		}
+	}
+
+	~ThreadPool() {
+		Wait();
+		{
+			lock_guard<mutex> lock(sleepMutex);
+			stop.store(true);
+		}
+		sleepCv.notify_all();
+		for (Worker& w : workers)
+			w.t.join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// runs f(args...) on a worker, the arguments are copied like with std::thread
+	template <typename F, typename... Args>
+	void Submit(F&& f, Args&&... args) {
+		auto call = [fn = std::forward<F>(f), tup = make_tuple(std::forward<Args>(args)...)]() mutable {
+			std::apply(fn, tup);
+		};
+		Enqueue(new TaskOf<decltype(call)>(std::move(call)));
+	}
+
+	// waits until every submitted task (and the tasks they submitted) is finished
+	void Wait() {
+		unique_lock<mutex> lock(doneMutex);
+		doneCv.wait(lock, [this] { return pending.load(memory_order_acquire) == 0; });
+	}
+
+	size_t Size() const { return workers.size(); }
+
+	long Steals() const {
+		long n = 0;
+		for (const Worker& w : workers)
+			n += w.steals.load(memory_order_relaxed);
+		return n;
+	}
+
+private:
+	struct alignas(64) Worker {
+		ChaseLevDeque deque;
+		thread t;
+		uint32_t rng = 0;
+		atomic<long> steals{0};
+	};
+
+	// the worker running on this thread, so nested Submit goes to its own deque
+	struct Current {
+		ThreadPool* pool = nullptr;
+		unsigned index = 0;
+	};
+	static Current& Me() {
+		static thread_local Current current;
+		return current;
+	}
+
+	void Enqueue(Task* task) {
+		pending.fetch_add(1, memory_order_relaxed);
+		Current& me = Me();
+		if (me.pool == this)
+			workers[me.index].deque.Push(task);
+		else {
+			lock_guard<mutex> lock(injectedMutex);
+			injected.push_back(task);
+			injectedSize.store(injected.size(), memory_order_relaxed);
+		}
+
+		// pairs with the fence in Sleep(): either we see the sleeper or the sleeper sees the task
+		atomic_thread_fence(memory_order_seq_cst);
+		if (sleepers.load(memory_order_relaxed) > 0) {
+			lock_guard<mutex> lock(sleepMutex);
+			sleepCv.notify_one();
+		}
+	}
+
+	Task* TakeInjected() {
+		if (injectedSize.load(memory_order_relaxed) == 0)
+			return nullptr;
+		lock_guard<mutex> lock(injectedMutex);
+		if (injected.empty())
+			return nullptr;
+		Task* task = injected.front();
+		injected.pop_front();
+		injectedSize.store(injected.size(), memory_order_relaxed);
+		return task;
+	}
+
+	Task* FindTask(unsigned self) {
+		Worker& me = workers[self];
+		if (Task* task = me.deque.Pop())
+			return task;
+		if (Task* task = TakeInjected())
+			return task;
+
+		// steal, starting from a random victim
+		size_t n = workers.size();
+		me.rng ^= me.rng << 13;
+		me.rng ^= me.rng >> 17;
+		me.rng ^= me.rng << 5;
+		size_t start = me.rng % n;
+		for (size_t k = 0; k < n; ++k) {
+			size_t victim = (start + k) % n;
+			if (victim == self)
+				continue;
+			if (Task* task = workers[victim].deque.Steal()) {
+				me.steals.fetch_add(1, memory_order_relaxed);
+				return task;
+			}
+		}
+		return nullptr;
+	}
+
+	bool HasWork() {
+		if (injectedSize.load(memory_order_relaxed) > 0)
+			return true;
+		for (Worker& w : workers)
+			if (!w.deque.Empty())
+				return true;
+		return false;
+	}
+
+	void RunTask(Task* task) {
+		task->Run();
+		delete task;
+		if (pending.fetch_sub(1, memory_order_acq_rel) == 1) {
+			lock_guard<mutex> lock(doneMutex);
+			doneCv.notify_all();
+		}
+	}
+
+	void Sleep() {
+		unique_lock<mutex> lock(sleepMutex);
+		sleepers.fetch_add(1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_seq_cst);
+		if (!stop.load() && !HasWork())
+			sleepCv.wait(lock);
+		sleepers.fetch_sub(1, memory_order_relaxed);
+	}
+
+	void WorkerLoop(unsigned self) {
+		Me().pool = this;
+		Me().index = self;
+
+		while (true) {
+			Task* task = FindTask(self);
+			for (int round = 0; task == nullptr && round < 64; ++round) {
+				this_thread::yield();
+				task = FindTask(self);
+			}
+			if (task != nullptr) {
+				RunTask(task);
+				continue;
+			}
+			if (stop.load() && !HasWork())
+				return;
+			Sleep();
+		}
+	}
+
+	vector<Worker> workers;
+	atomic<bool> stop;
+
+	mutex sleepMutex;
+	condition_variable sleepCv;
+	atomic<int> sleepers;
+
+	alignas(64) atomic<long> pending;	// submitted and not finished yet
+	mutex doneMutex;
+	condition_variable doneCv;
+
+	mutex injectedMutex;
+	deque<Task*> injected;
+	atomic<size_t> injectedSize;
+};
+
+// the five callables of 2-ThreadCreation.cpp, they add instead of printing
+atomic<ull> total(0);
+
+void fun(int x) {
+	while (x-- > 0)
+		total += x;
+}
+
+class Functor {
+public:
+	void operator ()(int x) {
+		while (x-- > 0)
+			total += x;
+	}
+};
+
+class Base {
+public:
+	void run(int x) {
+		while (x-- > 0)
+			total += x;
+	}
+	static void runStatic(int x) {
+		while (x-- > 0)
+			total += x;
+	}
+};
+
+// sum of [start, end], split in two halves until the range is small, halves are stolen by idle workers
+void rangeSum(ThreadPool* pool, ull start, ull end, atomic<ull>* sum) {
+	if (end - start < 100000) {
+		ull s = 0;
+		for (ull i = start; i <= end; ++i)
+			s += i;
+		*sum += s;
+		return;
+	}
+	ull mid = start + (end - start) / 2;
+	pool->Submit(rangeSum, pool, start, mid, sum);
+	rangeSum(pool, mid + 1, end, sum);
+}
+
+int main() {
+	ThreadPool pool;
+	cout << "workers: " << pool.Size() << endl;
+
+	// 1. same callables as std::thread
+	Base b;
+	pool.Submit(fun, 10);
+	pool.Submit([](int x) { while (x-- > 0) total += x; }, 10);
+	pool.Submit(Functor(), 10);
+	pool.Submit(&Base::run, &b, 10);
+	pool.Submit(&Base::runStatic, 10);
+	pool.Wait();
+	cout << "5 callables, total: " << total << " (expected " << 5 * 45 << ")" << endl;
+
+	// 2. one std::thread per task vs the pool
+	const int Threads = 2000;
+	auto startTime = high_resolution_clock::now();
+	for (int i = 0; i < Threads; ++i) {
+		thread t(fun, 10);
+		t.join();
+	}
+	double threadNs = duration<double, nano>(high_resolution_clock::now() - startTime).count() / Threads;
+
+	const int Tasks = 1000000;
+	startTime = high_resolution_clock::now();
+	for (int i = 0; i < Tasks; ++i)
+		pool.Submit(fun, 10);
+	double submitNs = duration<double, nano>(high_resolution_clock::now() - startTime).count() / Tasks;
+	pool.Wait();
+	double taskNs = duration<double, nano>(high_resolution_clock::now() - startTime).count() / Tasks;
+
+	cout << "new std::thread per call : " << threadNs << " ns per call" << endl;
+	cout << "pool submit              : " << submitNs << " ns per task" << endl;
+	cout << "pool submit + run        : " << taskNs << " ns per task" << endl;
+
+	// 3. nested tasks and stealing
+	atomic<ull> sum(0);
+	ull end = 1900000000;
+	startTime = high_resolution_clock::now();
+	pool.Submit(rangeSum, &pool, 0, end, &sum);
+	pool.Wait();
+	auto duration = duration_cast<milliseconds>(high_resolution_clock::now() - startTime);
+	cout << "sum 0.." << end << " : " << sum << " (expected " << end * (end + 1) / 2 << ") in "
+	     << duration.count() << " ms, steals: " << pool.Steals() << endl;
+
+	return 0;
+}
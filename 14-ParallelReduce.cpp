@@ -0,0 +1,137 @@
+// TOPIC: Parallel Reduce
+
+// NOTES:
+// 0. 1-IntroToThread.cpp uses exactly two threads, findEven and findOdd, and each one scans the whole
+//    range 0..1900000000. On a machine with 16 cores 14 cores do nothing, and the two sums are written
+//    through pointers to variables which sit in the same cache line (see 12-FalseSharing.cpp).
+// 1. parallel_reduce(range, identity, op) splits the range into chunks over all the cores:
+//    a. every thread keeps its own partial result, starting from identity, and applies
+//       acc = op(acc, i) for every i of the chunks it takes.
+//    b. the partials are cache padded, so the threads never write to the same cache line.
+//    c. at the end the partials are combined with combine(a, b) (std::plus by default).
+// 2. Chunks are taken from a shared atomic counter (dynamic scheduling): a thread which is faster
+//    or less loaded simply takes more chunks, there are several chunks per thread for this.
+// 3. Requirements: op and combine must be associative and identity must be neutral, because the
+//    order in which the chunks are combined is not fixed.
+//    (for floating point sums the result can differ in the last bits between runs)
+// 4. The calling thread works too, so parallel_reduce uses hardware_concurrency() - 1 new threads.
+
+// To build: g++ -std=c++17 -O2 -pthread 14-ParallelReduce.cpp
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+using namespace std;
+using namespace std::chrono;
+typedef long long int  ull;
+
+constexpr size_t CacheLineSize = 64;
+
+template <typename T>
+struct alignas(CacheLineSize) CachePadded {
+	T value;
+};
+
+// [begin, end], both included like findEven/findOdd
+struct IndexRange {
+	ull begin;
+	ull end;
+};
+
+template <typename T, typename Op, typename Combine = std::plus<T>>
+T parallel_reduce(IndexRange range, T identity, Op op, Combine combine = Combine(),
+                  unsigned threads = thread::hardware_concurrency()) {
+	if (range.end < range.begin)
+		return identity;
+	if (threads == 0)
+		threads = 1;
+
+	ull count = range.end - range.begin + 1;
+	ull chunk = max<ull>(count / (threads * 8ull), 4096);
+	ull chunks = (count + chunk - 1) / chunk;
+
+	vector<CachePadded<T>> partials(threads, CachePadded<T>{identity});
+	atomic<ull> nextChunk(0);
+
+	auto work = [&](unsigned t) {
+		T acc = partials[t].value;		// kept in a register, written once at the end
+		for (ull c = nextChunk.fetch_add(1, memory_order_relaxed); c < chunks;
+		     c = nextChunk.fetch_add(1, memory_order_relaxed)) {
+			ull first = range.begin + c * chunk;
+			ull last = min(first + chunk - 1, range.end);
+			for (ull i = first; i <= last; ++i)
+				acc = op(acc, i);
+		}
+		partials[t].value = acc;
+	};
+
+	vector<thread> workers;
+	for (unsigned t = 1; t < threads; ++t)
+		workers.emplace_back(work, t);
+	work(0);
+	for (thread& w : workers)
+		w.join();
+
+	T result = identity;
+	for (const CachePadded<T>& p : partials)
+		result = combine(result, p.value);
+	return result;
+}
+
+// findEven and findOdd from 1-IntroToThread.cpp
+void findEven(ull start, ull end, ull* EvenSum) {
+	for (ull i = start; i <= end; ++i){
+		if (!(i & 1)){
+			*(EvenSum) += i;
+		}
+	}
+}
+
+void findOdd(ull start, ull end, ull* OddSum) {
+	for (ull i = start; i <= end; ++i){
+		if (i & 1){
+			(*OddSum) += i;
+		}
+	}
+}
+
+int main() {
+	ull start = 0, end = 1900000000;
+
+	// two threads, like 1-IntroToThread.cpp
+	ull OddSum = 0;
+	ull EvenSum = 0;
+	auto startTime = high_resolution_clock::now();
+	std::thread t1(findEven, start, end, &(EvenSum));
+	std::thread t2(findOdd, start, end, &(OddSum));
+	t1.join();
+	t2.join();
+	auto twoThreads = duration_cast<milliseconds>(high_resolution_clock::now() - startTime);
+
+	// parallel_reduce over all the cores
+	startTime = high_resolution_clock::now();
+	ull evenSum = parallel_reduce(IndexRange{start, end}, (ull)0,
+	                              [](ull acc, ull i) { return (i & 1) ? acc : acc + i; });
+	ull oddSum = parallel_reduce(IndexRange{start, end}, (ull)0,
+	                             [](ull acc, ull i) { return (i & 1) ? acc + i : acc; });
+	auto reduced = duration_cast<milliseconds>(high_resolution_clock::now() - startTime);
+
+	// other reductions: max of a function, count of multiples
+	ull maxMod = parallel_reduce(IndexRange{start, 1000000}, (ull)0,
+	                             [](ull acc, ull i) { return max(acc, i * 2654435761ll % 1000003); },
+	                             [](ull a, ull b) { return max(a, b); });
+	ull multiplesOf7 = parallel_reduce(IndexRange{1, 1000000}, (ull)0,
+	                                   [](ull acc, ull i) { return acc + (i % 7 == 0); });
+
+	cout << "OddSum : " << OddSum << " / " << oddSum << endl;
+	cout << "EvenSum : " << EvenSum << " / " << evenSum << endl;
+	cout << "two threads       : " << twoThreads.count() << " ms" << endl;
+	cout << "parallel_reduce   : " << reduced.count() << " ms on " << thread::hardware_concurrency() << " cores" << endl;
+	cout << "max hash : " << maxMod << ", multiples of 7 : " << multiplesOf7 << endl;
+
+	return 0;
+}
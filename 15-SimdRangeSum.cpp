@@ -0,0 +1,308 @@
+// TOPIC: Vectorized Range Sums And Closed Form Shortcuts
+
+// NOTES:
+// 0. findEven/findOdd in 1-IntroToThread.cpp test (i & 1) for every i, one number per iteration with a
+//    branch which is taken every second time. Threads (14-ParallelReduce.cpp) only divide this cost by the
+//    number of cores.
+// 1. SIMD (single instruction multiple data): one instruction works on a vector of numbers.
+//    a. SSE4.1 registers hold 2 x 64 bit integers, AVX2 registers hold 4 x 64 bit integers.
+//    b. The filter becomes branchless: keep = (i & mask) == residue gives all ones or all zeros per lane,
+//       sum += keep & i adds the number or 0.
+//    c. Kernels:
+//       SumEvery(start, end, step)         : start + (start+step) + ... up to end
+//       SumWhere(start, end, mask, residue): all i in [start, end] with (i & mask) == residue
+//                                            (even numbers: mask 1 residue 0, odd: mask 1 residue 1)
+// 2. Runtime dispatch: the program is built for any x86-64 cpu, only the kernel functions are compiled
+//    for AVX2/SSE4.1 (__attribute__((target(...)))). At startup __builtin_cpu_supports picks the best
+//    kernel the cpu has, so the same binary runs everywhere.
+// 3. Closed form: a pure range is an arithmetic series, its sum is n * first + step * n * (n - 1) / 2,
+//    no loop at all. SumWhere is also an arithmetic series when mask is 2^k - 1 (the low k bits).
+//    The intermediate products are computed with 128 bit integers so they can't overflow.
+// 4. Modes:
+//    a. Fast   : closed form when possible, SIMD kernel otherwise.
+//    b. Kernel : always the SIMD loop (brute force).
+//    c. Verify : both, throws std::logic_error if they don't give the same result.
+
+// To build: g++ -std=c++17 -O2 15-SimdRangeSum.cpp   (x86-64)
+
+#include <iostream>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <climits>
+#include <immintrin.h>
+using namespace std;
+using namespace std::chrono;
+typedef long long int  ull;
+
+enum class SumMode { Fast, Kernel, Verify };
+
+                        /* scalar kernels, the reference */
+ull SumEveryScalar(ull start, ull end, ull step) {
+	ull sum = 0;
+	for (ull i = start; i <= end; i += step)
+		sum += i;
+	return sum;
+}
+
+ull SumWhereScalar(ull start, ull end, ull mask, ull residue) {
+	ull sum = 0;
+	for (ull i = start; i <= end; ++i)
+		if ((i & mask) == residue)
+			sum += i;
+	return sum;
+}
+
+                        /* SSE4.1: 2 lanes */
+__attribute__((target("sse4.1")))
+ull SumEverySse(ull start, ull end, ull step) {
+	ull n = (end - start) / step + 1;
+	__m128i v = _mm_set_epi64x(start + step, start);
+	__m128i inc = _mm_set1_epi64x(2 * step);
+	__m128i acc = _mm_setzero_si128();
+	ull blocks = n / 2;
+	for (ull b = 0; b < blocks; ++b) {
+		acc = _mm_add_epi64(acc, v);
+		v = _mm_add_epi64(v, inc);
+	}
+	ull sum = _mm_extract_epi64(acc, 0) + _mm_extract_epi64(acc, 1);
+	for (ull k = blocks * 2; k < n; ++k)
+		sum += start + k * step;
+	return sum;
+}
+
+__attribute__((target("sse4.1")))
+ull SumWhereSse(ull start, ull end, ull mask, ull residue) {
+	ull n = end - start + 1;
+	__m128i v = _mm_set_epi64x(start + 1, start);
+	__m128i two = _mm_set1_epi64x(2);
+	__m128i m = _mm_set1_epi64x(mask);
+	__m128i r = _mm_set1_epi64x(residue);
+	__m128i acc = _mm_setzero_si128();
+	ull blocks = n / 2;
+	for (ull b = 0; b < blocks; ++b) {
+		__m128i keep = _mm_cmpeq_epi64(_mm_and_si128(v, m), r);
+		acc = _mm_add_epi64(acc, _mm_and_si128(keep, v));
+		v = _mm_add_epi64(v, two);
+	}
+	ull sum = _mm_extract_epi64(acc, 0) + _mm_extract_epi64(acc, 1);
+	return sum + SumWhereScalar(start + blocks * 2, end, mask, residue);
+}
+
+                        /* AVX2: 4 lanes, two accumulators so the adds don't wait for each other */
+__attribute__((target("avx2")))
+ull HorizontalSum(__m256i v) {
+	__m128i s = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+	return _mm_cvtsi128_si64(s) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(s, s));
+}
+
+__attribute__((target("avx2")))
+ull SumEveryAvx2(ull start, ull end, ull step) {
+	ull n = (end - start) / step + 1;
+	__m256i v0 = _mm256_set_epi64x(start + 3 * step, start + 2 * step, start + step, start);
+	__m256i v1 = _mm256_add_epi64(v0, _mm256_set1_epi64x(4 * step));
+	__m256i inc = _mm256_set1_epi64x(8 * step);
+	__m256i acc0 = _mm256_setzero_si256();
+	__m256i acc1 = _mm256_setzero_si256();
+	ull blocks = n / 8;
+	for (ull b = 0; b < blocks; ++b) {
+		acc0 = _mm256_add_epi64(acc0, v0);
+		acc1 = _mm256_add_epi64(acc1, v1);
+		v0 = _mm256_add_epi64(v0, inc);
+		v1 = _mm256_add_epi64(v1, inc);
+	}
+	ull sum = HorizontalSum(_mm256_add_epi64(acc0, acc1));
+	for (ull k = blocks * 8; k < n; ++k)
+		sum += start + k * step;
+	return sum;
+}
+
+__attribute__((target("avx2")))
+ull SumWhereAvx2(ull start, ull end, ull mask, ull residue) {
+	ull n = end - start + 1;
+	__m256i v0 = _mm256_set_epi64x(start + 3, start + 2, start + 1, start);
+	__m256i v1 = _mm256_add_epi64(v0, _mm256_set1_epi64x(4));
+	__m256i eight = _mm256_set1_epi64x(8);
+	__m256i m = _mm256_set1_epi64x(mask);
+	__m256i r = _mm256_set1_epi64x(residue);
+	__m256i acc0 = _mm256_setzero_si256();
+	__m256i acc1 = _mm256_setzero_si256();
+	ull blocks = n / 8;
+	for (ull b = 0; b < blocks; ++b) {
+		__m256i keep0 = _mm256_cmpeq_epi64(_mm256_and_si256(v0, m), r);
+		__m256i keep1 = _mm256_cmpeq_epi64(_mm256_and_si256(v1, m), r);
+		acc0 = _mm256_add_epi64(acc0, _mm256_and_si256(keep0, v0));
+		acc1 = _mm256_add_epi64(acc1, _mm256_and_si256(keep1, v1));
+		v0 = _mm256_add_epi64(v0, eight);
+		v1 = _mm256_add_epi64(v1, eight);
+	}
+	ull sum = HorizontalSum(_mm256_add_epi64(acc0, acc1));
+	return sum + SumWhereScalar(start + blocks * 8, end, mask, residue);
+}
+
+                        /* runtime dispatch */
+struct Kernels {
+	const char* name;
+	ull (*every)(ull, ull, ull);
+	ull (*where)(ull, ull, ull, ull);
+};
+
+const Kernels ScalarKernels = { "scalar", SumEveryScalar, SumWhereScalar };
+const Kernels SseKernels = { "sse4.1", SumEverySse, SumWhereSse };
+const Kernels Avx2Kernels = { "avx2", SumEveryAvx2, SumWhereAvx2 };
+
+const Kernels& BestKernels() {
+	static const Kernels& best = __builtin_cpu_supports("avx2") ? Avx2Kernels
+	                           : __builtin_cpu_supports("sse4.1") ? SseKernels
+	                           : ScalarKernels;
+	return best;
+}
+
+                        /* closed forms */
+// first + (first+step) + ... n terms, wraps like the kernels when the sum doesn't fit in 64 bits
+// step and n are unsigned: SumWhereClosed may use a step of 2^63
+ull ArithmeticSeries(ull first, unsigned long long step, unsigned long long n) {
+	// n * (n - 1) / 2 without a division after a possible overflow
+	unsigned __int128 pairs = n % 2 == 0 ? (unsigned __int128)(n / 2) * (n - 1) : (unsigned __int128)n * ((n - 1) / 2);
+	unsigned __int128 s = (unsigned __int128)n * (unsigned long long)first + pairs * step;
+	return (ull)(unsigned long long)s;
+}
+
+ull SumEveryClosed(ull start, ull end, ull step) {
+	return ArithmeticSeries(start, step, (end - start) / step + 1);
+}
+
+// only for mask = 2^k - 1: the kept numbers are residue, residue + 2^k, ...
+// the mask arithmetic is unsigned, mask + 1 overflows a signed ull for LLONG_MAX and all ones (-1)
+bool LowBitsMask(ull mask) {
+	unsigned long long m = (unsigned long long)mask;
+	return (m & (m + 1)) == 0;		// all ones: m + 1 wraps to 0
+}
+
+// end >= start
+ull SumWhereClosed(ull start, ull end, ull mask, ull residue) {
+	unsigned long long m = (unsigned long long)mask, r = (unsigned long long)residue;
+	if ((r & ~m) != 0)
+		return 0;
+	unsigned long long span = (unsigned long long)end - (unsigned long long)start;
+	unsigned long long offset = (r - (unsigned long long)start) & m;
+	if (offset > span)
+		return 0;
+	ull first = (ull)((unsigned long long)start + offset);
+	if (m == ~0ull)
+		return first;				// all 64 bits: only residue itself, there is no step 2^64
+	unsigned long long step = m + 1;
+	return ArithmeticSeries(first, step, (span - offset) / step + 1);
+}
+
+void Check(const char* what, ull closed, ull kernel) {
+	if (closed != kernel)
+		throw logic_error(string(what) + ": closed form " + to_string(closed) + " != kernel " + to_string(kernel));
+}
+
+                        /* public functions */
+// start + (start+step) + ... <= end, step > 0
+ull SumEvery(ull start, ull end, ull step, SumMode mode = SumMode::Fast) {
+	if (end < start || step <= 0)
+		return 0;
+	if (mode == SumMode::Fast)
+		return SumEveryClosed(start, end, step);
+	ull kernel = BestKernels().every(start, end, step);
+	if (mode == SumMode::Verify)
+		Check("SumEvery", SumEveryClosed(start, end, step), kernel);
+	return kernel;
+}
+
+// sum of i in [start, end] with (i & mask) == residue
+ull SumWhere(ull start, ull end, ull mask, ull residue, SumMode mode = SumMode::Fast) {
+	if (end < start)
+		return 0;
+	bool closed = LowBitsMask(mask);
+	if (mode == SumMode::Fast && closed)
+		return SumWhereClosed(start, end, mask, residue);
+	ull kernel = BestKernels().where(start, end, mask, residue);
+	if (mode == SumMode::Verify && closed)
+		Check("SumWhere", SumWhereClosed(start, end, mask, residue), kernel);
+	return kernel;
+}
+
+// findEven and findOdd from 1-IntroToThread.cpp
+void findEven(ull start, ull end, ull* EvenSum) {
+	for (ull i = start; i <= end; ++i){
+		if (!(i & 1)){
+			*(EvenSum) += i;
+		}
+	}
+}
+
+void findOdd(ull start, ull end, ull* OddSum) {
+	for (ull i = start; i <= end; ++i){
+		if (i & 1){
+			(*OddSum) += i;
+		}
+	}
+}
+
+double Ms(high_resolution_clock::time_point from) {
+	return duration<double, milli>(high_resolution_clock::now() - from).count();
+}
+
+int main() {
+	ull start = 0, end = 1900000000;
+	cout << "kernel: " << BestKernels().name << endl;
+
+	// every available kernel against the scalar reference and the closed forms, on small ranges
+	const Kernels* all[] = { &ScalarKernels, &SseKernels, &Avx2Kernels };
+	int checked = 0;
+	for (const Kernels* k : all) {
+		if ((k == &SseKernels && !__builtin_cpu_supports("sse4.1")) || (k == &Avx2Kernels && !__builtin_cpu_supports("avx2")))
+			continue;
+		for (ull s = 0; s < 40; s += 3)
+			for (ull e = s; e < s + 70; e += 7) {
+				for (ull step = 1; step < 6; ++step)
+					Check(k->name, SumEveryClosed(s, e, step), k->every(s, e, step));
+				for (ull mask : {1, 3, 7, 5})
+					for (ull residue = 0; residue <= mask; ++residue) {
+						ull kernel = k->where(s, e, mask, residue);
+						Check(k->name, SumWhereScalar(s, e, mask, residue), kernel);
+						if (LowBitsMask(mask))
+							Check(k->name, SumWhereClosed(s, e, mask, residue), kernel);
+						++checked;
+					}
+				// masks whose mask + 1 doesn't fit in a signed ull
+				for (ull mask : {LLONG_MAX, (ull)-1})
+					for (ull residue : {(ull)0, s + 1, e, LLONG_MAX})
+						Check(k->name, SumWhereScalar(s, e, mask, residue), SumWhereClosed(s, e, mask, residue));
+			}
+	}
+	cout << "verified " << checked << " filtered sums on every kernel" << endl;
+
+	// the 1-IntroToThread.cpp sums
+	ull OddSum = 0, EvenSum = 0;
+	auto t0 = high_resolution_clock::now();
+	findEven(start, end, &EvenSum);
+	findOdd(start, end, &OddSum);
+	double scalarMs = Ms(t0);
+
+	t0 = high_resolution_clock::now();
+	ull evenKernel = SumWhere(start, end, 1, 0, SumMode::Kernel);
+	ull oddKernel = SumWhere(start, end, 1, 1, SumMode::Kernel);
+	double kernelMs = Ms(t0);
+
+	t0 = high_resolution_clock::now();
+	ull evenFast = SumWhere(start, end, 1, 0);
+	ull oddFast = SumWhere(start, end, 1, 1);
+	double fastMs = Ms(t0);
+
+	SumWhere(start, end, 1, 0, SumMode::Verify);
+	SumWhere(start, end, 1, 1, SumMode::Verify);
+	SumEvery(start, end, 3, SumMode::Verify);
+
+	cout << "OddSum : " << OddSum << " / " << oddKernel << " / " << oddFast << endl;
+	cout << "EvenSum : " << EvenSum << " / " << evenKernel << " / " << evenFast << endl;
+	cout << "findEven + findOdd : " << scalarMs << " ms" << endl;
+	cout << "SIMD kernel        : " << kernelMs << " ms" << endl;
+	cout << "closed form        : " << fastMs << " ms" << endl;
+
+	return 0;
+}
@@ -0,0 +1,175 @@
+// TOPIC: Sharded Counter
+
+// NOTES:
+// 0. 4-Mutex.cpp and 11-ConditionVariable.cpp lock a std::mutex for every ++myAmount. With many threads
+//    they all wait for the same mutex, and even std::atomic<int> does not scale: every fetch_add needs the
+//    cache line of the counter in its own core, so the line moves from core to core on every increment.
+// 1. ShardedCounter splits the counter into cells, one cache line each (see 12-FalseSharing.cpp):
+//    a. Add(n) does a relaxed fetch_add on the cell of the calling thread, the line normally stays in
+//       the cache of one core, so the add costs almost the same as on a local variable.
+//    b. Read() adds all the cells. It is slower than Add and, while threads are adding, it is not a
+//       snapshot of one moment, but every finished Add is counted. Good for statistics, not for
+//       decisions like "take a ticket only if counter < 10".
+// 2. How a thread finds its cell:
+//    a. PerThread: every thread gets the next cell number on its first Add (thread_local), threads
+//       share a cell only when there are more threads than cells.
+//    b. PerCpu   : the cell of the cpu the thread runs on right now (sched_getcpu), good when there are
+//       many more threads than cores. The thread can move to another cpu during the Add, that is fine
+//       because the add itself is atomic.
+// 3. The cost is memory: cells * 64 bytes per counter.
+
+// To build: g++ -std=c++17 -O2 -pthread 16-ShardedCounter.cpp   (linux)
+
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <chrono>
+#include <sched.h>
+using namespace std;
+using namespace std::chrono;
+
+constexpr size_t CacheLineSize = 64;
+
+template <typename T>
+struct alignas(CacheLineSize) CachePadded {
+	T value{};
+};
+
+enum class ShardPolicy { PerThread, PerCpu };
+
+class ShardedCounter {
+public:
+	explicit ShardedCounter(ShardPolicy policy = ShardPolicy::PerThread, unsigned cells = 0)
+		: policy(policy), cells(RoundUpPow2(cells ? cells : 2 * max(1u, thread::hardware_concurrency()))) {
+		mask = this->cells.size() - 1;
+	}
+
+	void Add(long n = 1) {
+		cells[Cell()].value.fetch_add(n, memory_order_relaxed);
+	}
+
+	ShardedCounter& operator++() {
+		Add(1);
+		return *this;
+	}
+
+	long Read() const {
+		long sum = 0;
+		for (const CachePadded<atomic<long>>& c : cells)
+			sum += c.value.load(memory_order_relaxed);
+		return sum;
+	}
+
+	size_t Cells() const { return cells.size(); }
+
+private:
+	static size_t RoundUpPow2(size_t n) {
+		size_t p = 1;
+		while (p < n)
+			p <<= 1;
+		return p;
+	}
+
+	size_t Cell() const {
+		if (policy == ShardPolicy::PerCpu) {
+			int cpu = sched_getcpu();
+			return cpu < 0 ? ThreadSlot() & mask : (size_t)cpu & mask;
+		}
+		return ThreadSlot() & mask;
+	}
+
+	// a number per thread, given once, shared by all the counters
+	static size_t ThreadSlot() {
+		static atomic<size_t> next(0);
+		static thread_local size_t slot = next.fetch_add(1, memory_order_relaxed);
+		return slot;
+	}
+
+	ShardPolicy policy;
+	vector<CachePadded<atomic<long>>> cells;
+	size_t mask;
+};
+
+// the counters of the benchmark, all used as ++counter
+struct MutexCounter {
+	long myAmount = 0;
+	std::mutex m;
+	void Add() {
+		m.lock();
+		++myAmount;
+		m.unlock();
+	}
+	long Read() { lock_guard<mutex> lock(m); return myAmount; }
+};
+
+struct AtomicCounter {
+	atomic<long> myAmount{0};
+	void Add() { ++myAmount; }		// seq_cst, like most code writes it
+	long Read() { return myAmount.load(); }
+};
+
+struct RelaxedCounter {
+	atomic<long> myAmount{0};
+	void Add() { myAmount.fetch_add(1, memory_order_relaxed); }
+	long Read() { return myAmount.load(); }
+};
+
+struct ShardedThreadCounter {
+	ShardedCounter myAmount{ShardPolicy::PerThread};
+	void Add() { ++myAmount; }
+	long Read() { return myAmount.Read(); }
+};
+
+struct ShardedCpuCounter {
+	ShardedCounter myAmount{ShardPolicy::PerCpu};
+	void Add() { ++myAmount; }
+	long Read() { return myAmount.Read(); }
+};
+
+// total increments per second (millions), every thread adds perThread times
+template <typename Counter>
+double Mops(unsigned threads, long perThread, bool& correct) {
+	Counter counter;
+	vector<thread> workers;
+	auto startTime = high_resolution_clock::now();
+	for (unsigned t = 0; t < threads; ++t)
+		workers.emplace_back([&counter, perThread] {
+			for (long i = 0; i < perThread; ++i)
+				counter.Add();
+		});
+	for (thread& w : workers)
+		w.join();
+	double us = duration<double, micro>(high_resolution_clock::now() - startTime).count();
+	correct = correct && counter.Read() == perThread * threads;
+	return threads * perThread / us;
+}
+
+int main() {
+	// 4-Mutex.cpp with a sharded counter
+	ShardedCounter myAmount;
+	thread t1([&] { ++myAmount; });
+	thread t2([&] { ++myAmount; });
+	t1.join();
+	t2.join();
+	cout << "myAmount: " << myAmount.Read() << " (" << myAmount.Cells() << " cells)" << endl;
+
+	const long Total = 8000000;
+	bool correct = true;
+	cout << setw(8) << "threads" << setw(12) << "mutex" << setw(12) << "atomic ++" << setw(12) << "fetch_add"
+	     << setw(14) << "sharded/thr" << setw(14) << "sharded/cpu" << "   (million adds per second)" << endl;
+	for (unsigned threads : {1u, 2u, 4u, 8u, 16u, 32u, 64u}) {
+		long perThread = Total / threads;
+		cout << fixed << setprecision(1) << setw(8) << threads
+		     << setw(12) << Mops<MutexCounter>(threads, perThread, correct)
+		     << setw(12) << Mops<AtomicCounter>(threads, perThread, correct)
+		     << setw(12) << Mops<RelaxedCounter>(threads, perThread, correct)
+		     << setw(14) << Mops<ShardedThreadCounter>(threads, perThread, correct)
+		     << setw(14) << Mops<ShardedCpuCounter>(threads, perThread, correct) << endl;
+	}
+	cout << "all counts correct: " << correct << endl;
+
+	return 0;
+}
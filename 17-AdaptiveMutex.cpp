@@ -0,0 +1,204 @@
+// TOPIC: Adaptive Spin Then Park Mutex
+
+// NOTES:
+// 0. In 5-MutexTryLock.cpp a failed mtx.try_lock() simply skips ++counter, so counter ends far below
+//    200000: the work is silently lost. std::mutex::lock() doesn't lose work but, when the mutex is
+//    taken, it often puts the thread to sleep at once, and waking it up costs a few microseconds,
+//    much more than the critical section (one ++).
+// 1. AdaptiveMutex:
+//    a. lock() first spins: it checks the mutex, waits with the pause instruction and checks again,
+//       doubling the wait every round (exponential backoff), the owner usually unlocks in a few
+//       hundred cycles so most locks are taken without sleeping.
+//    b. after a bounded number of rounds it parks: the thread sleeps in the kernel on a futex
+//       (fast userspace mutex, the linux system call std::mutex uses too) until unlock() wakes it.
+//    c. adaptive: the mutex remembers how long spinning needed recently and spins a bit longer than
+//       that, so when the owner holds the lock for long the threads stop wasting cpu on spinning.
+// 2. State of the mutex (one int): 0 free, 1 locked, 2 locked and maybe threads sleeping.
+//    unlock() makes a futex wake system call only in state 2, an uncontended lock/unlock is one
+//    compare and swap + one exchange, no system call.
+// 3. try_lock_for(spins): spins at most spins pause instructions and returns false if the mutex is
+//    still taken, it never sleeps. On false the caller must still do its work (lock() or retry),
+//    not drop it like 5-MutexTryLock.cpp.
+// 4. lock/unlock/try_lock are the names std::lock_guard and std::unique_lock need.
+
+// To build: g++ -std=c++17 -O2 -pthread 17-AdaptiveMutex.cpp   (linux)
+
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <chrono>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+using namespace std;
+using namespace std::chrono;
+
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+
+inline void FutexWait(atomic<int>* addr, int expected) {
+	syscall(SYS_futex, reinterpret_cast<int*>(addr), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+inline void FutexWake(atomic<int>* addr, int count) {
+	syscall(SYS_futex, reinterpret_cast<int*>(addr), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+class AdaptiveMutex {
+public:
+	static const int MinSpins = 64;
+	static const int MaxSpins = 16384;
+
+	AdaptiveMutex() : state(0), spinLimit(1024) {}
+	AdaptiveMutex(const AdaptiveMutex&) = delete;
+	AdaptiveMutex& operator=(const AdaptiveMutex&) = delete;
+
+	void lock() {
+		int expected = 0;
+		if (state.compare_exchange_strong(expected, 1, memory_order_acquire, memory_order_relaxed))
+			return;
+
+		int limit = spinLimit.load(memory_order_relaxed);
+		int spent = 0;
+		if (Spin(limit, spent)) {
+			// learn: spin a bit more than what was needed this time
+			Adapt(min(2 * spent, MaxSpins));
+			return;
+		}
+		Adapt(MinSpins);	// spinning didn't help, spin less next time
+
+		// park: mark the mutex as "maybe sleepers" and sleep until it is free
+		int c = state.exchange(2, memory_order_acquire);
+		while (c != 0) {
+			FutexWait(&state, 2);
+			c = state.exchange(2, memory_order_acquire);
+		}
+	}
+
+	bool try_lock() {
+		int expected = 0;
+		return state.compare_exchange_strong(expected, 1, memory_order_acquire, memory_order_relaxed);
+	}
+
+	// spins at most spins pause instructions, never sleeps
+	bool try_lock_for(int spins) {
+		if (try_lock())
+			return true;
+		int spent = 0;
+		return Spin(spins, spent);
+	}
+
+	void unlock() {
+		if (state.exchange(0, memory_order_release) == 2)
+			FutexWake(&state, 1);
+	}
+
+private:
+	// exponential backoff, returns true if the mutex was taken, spent counts the pause instructions
+	bool Spin(int limit, int& spent) {
+		int backoff = 1;
+		while (spent < limit) {
+			for (int i = 0; i < backoff; ++i)
+				CpuRelax();
+			spent += backoff;
+			if (backoff < 64)
+				backoff *= 2;
+
+			// read first, only try the compare and swap when it looks free
+			if (state.load(memory_order_relaxed) == 0) {
+				int expected = 0;
+				if (state.compare_exchange_weak(expected, 1, memory_order_acquire, memory_order_relaxed))
+					return true;
+			}
+		}
+		return false;
+	}
+
+	void Adapt(int observed) {
+		int old = spinLimit.load(memory_order_relaxed);
+		int next = old + (observed - old) / 8;
+		spinLimit.store(max(MinSpins, min(MaxSpins, next)), memory_order_relaxed);
+	}
+
+	atomic<int> state;
+	atomic<int> spinLimit;		// only a hint, races on it don't matter
+};
+
+// the loop of 5-MutexTryLock.cpp with the different locks
+int counter = 0;
+
+template <typename Mutex>
+void increaseWithTryLock(Mutex* mtx, int times) {
+	for (int i = 0; i < times; ++i) {
+		if (mtx->try_lock()) {
+			++counter;
+			mtx->unlock();
+		}
+	}
+}
+
+template <typename Mutex>
+void increaseWithLock(Mutex* mtx, int times) {
+	for (int i = 0; i < times; ++i) {
+		lock_guard<Mutex> lock(*mtx);
+		++counter;
+	}
+}
+
+void increaseWithTryLockFor(AdaptiveMutex* mtx, int times) {
+	for (int i = 0; i < times; ++i) {
+		if (!mtx->try_lock_for(256))
+			mtx->lock();		// could do other work first, but the increment is never dropped
+		++counter;
+		mtx->unlock();
+	}
+}
+
+template <typename Fn, typename Mutex>
+double Run(Fn fn, Mutex* mtx, unsigned threads, int times) {
+	counter = 0;
+	vector<thread> workers;
+	auto startTime = high_resolution_clock::now();
+	for (unsigned t = 0; t < threads; ++t)
+		workers.emplace_back(fn, mtx, times);
+	for (thread& w : workers)
+		w.join();
+	double us = duration<double, micro>(high_resolution_clock::now() - startTime).count();
+	return (double)threads * times / us;
+}
+
+int main() {
+	const int Times = 100000;
+	std::mutex mtx;
+	AdaptiveMutex adaptive;
+
+	// 5-MutexTryLock.cpp: 2 threads, try_lock drops increments
+	Run(increaseWithTryLock<std::mutex>, &mtx, 2, Times);
+	cout << "std::mutex try_lock        : counter " << counter << " of " << 2 * Times << endl;
+	Run(increaseWithTryLockFor, &adaptive, 2, Times);
+	cout << "AdaptiveMutex try_lock_for : counter " << counter << " of " << 2 * Times << endl;
+
+	cout << endl << setw(8) << "threads" << setw(14) << "std::mutex" << setw(14) << "adaptive"
+	     << setw(16) << "try_lock_for" << "   (million locked increments per second)" << endl;
+	for (unsigned threads : {1u, 2u, 4u, 8u, 16u}) {
+		bool correct = true;
+		double stdMops = Run(increaseWithLock<std::mutex>, &mtx, threads, Times);
+		correct = correct && counter == (int)threads * Times;
+		double adaptiveMops = Run(increaseWithLock<AdaptiveMutex>, &adaptive, threads, Times);
+		correct = correct && counter == (int)threads * Times;
+		double tryForMops = Run(increaseWithTryLockFor, &adaptive, threads, Times);
+		correct = correct && counter == (int)threads * Times;
+		cout << fixed << setprecision(1) << setw(8) << threads << setw(14) << stdMops << setw(14) << adaptiveMops
+		     << setw(16) << tryForMops << (correct ? "" : "   LOST INCREMENTS") << endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,227 @@
+// TOPIC: Event Driven Aggregation Of Several Producers
+
+// NOTES:
+// 0. consumeXY in 6-StdTryLock.cpp calls std::try_lock(m1, m2) in a while(1) loop. The producers sleep
+//    most of the time, but the consumer keeps one core at 100% only to find out that X or Y is still 0.
+// 1. Aggregator<T> replaces this loop:
+//    a. every producer (source) has its own slot, Publish(source, update) merges the update into it
+//       (merge is + by default, like ++X) under the mutex of that slot only, so producers of different
+//       sources don't wait for each other.
+//    b. a bit per source tells if the slot has new data since the last Take.
+//    c. Take(snapshot) sleeps on a condition variable until every required source has new data, then
+//       locks all the slots (always in the same order, so no dead lock), copies them, resets them
+//       and returns: the consumer sees X and Y of the same moment, never X new and Y old.
+//    d. only the producer whose publish completes the set of required sources wakes the consumer,
+//       the other publishes don't touch the condition variable.
+// 2. Optional sources (not required) are included in the snapshot when they have data, but the consumer
+//    doesn't wait for them.
+// 3. Close() ends the aggregation: Take returns false when the sources are closed and nothing complete
+//    is left, so the consumer doesn't need a useCount like consumeXY.
+
+// To build: g++ -std=c++17 -O2 -pthread 18-Aggregator.cpp
+
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <cstdint>
+#include <time.h>
+using namespace std;
+
+template <typename T, typename Merge = std::plus<T>>
+class Aggregator {
+public:
+	// sources 0..sources-1 (at most 64, one bit each), the ones in required must all have new data
+	// before Take returns. at least one source is required (with none Take would never wait and the
+	// consumer would spin again). throws invalid_argument otherwise
+	Aggregator(unsigned sources, vector<unsigned> required, T empty = T(), Merge merge = Merge())
+		: slots(CheckSources(sources)), requiredMask(0), readyMask(0), closed(false), empty(empty), merge(merge) {
+		if (required.empty())
+			throw invalid_argument("Aggregator: no required source");
+		for (unsigned s : required) {
+			if (s >= sources)
+				throw invalid_argument("Aggregator: required source " + to_string(s) + " >= sources");
+			requiredMask |= Bit(s);
+		}
+		for (Slot& slot : slots)
+			slot.value = empty;
+	}
+
+	// throws invalid_argument for a source >= sources
+	void Publish(unsigned source, const T& update) {
+		if (source >= slots.size())
+			throw invalid_argument("Aggregator: source " + to_string(source) + " >= sources");
+		Slot& slot = slots[source];
+		lock_guard<mutex> lock(slot.m);
+		slot.value = merge(slot.value, update);
+
+		uint64_t before = readyMask.fetch_or(Bit(source), memory_order_acq_rel);
+		uint64_t after = before | Bit(source);
+		if ((before & requiredMask) != requiredMask && (after & requiredMask) == requiredMask) {
+			lock_guard<mutex> wake(waitMutex);
+			ready.notify_one();
+		}
+	}
+
+	// waits for a complete set, copies all the slots to snapshot and resets them
+	// fresh[s] tells if source s had new data, returns false once closed
+	bool Take(vector<T>& snapshot, vector<bool>* fresh = nullptr) {
+		{
+			unique_lock<mutex> lock(waitMutex);
+			ready.wait(lock, [this] { return Complete() || closed; });
+			if (!Complete())
+				return false;
+		}
+
+		for (Slot& slot : slots)
+			slot.m.lock();
+		uint64_t mask = readyMask.exchange(0, memory_order_acq_rel);
+		snapshot.resize(slots.size());
+		if (fresh)
+			fresh->assign(slots.size(), false);
+		for (unsigned s = 0; s < slots.size(); ++s) {
+			snapshot[s] = slots[s].value;
+			slots[s].value = empty;
+			if (fresh)
+				(*fresh)[s] = (mask & Bit(s)) != 0;
+		}
+		for (Slot& slot : slots)
+			slot.m.unlock();
+		return true;
+	}
+
+	void Close() {
+		lock_guard<mutex> lock(waitMutex);
+		closed = true;
+		ready.notify_all();
+	}
+
+private:
+	struct alignas(64) Slot {
+		mutex m;
+		T value;
+	};
+
+	static unsigned CheckSources(unsigned sources) {
+		if (sources == 0 || sources > 64)
+			throw invalid_argument("Aggregator: sources must be 1..64");
+		return sources;
+	}
+
+	static uint64_t Bit(unsigned source) { return uint64_t(1) << source; }
+	bool Complete() const { return (readyMask.load(memory_order_acquire) & requiredMask) == requiredMask; }
+
+	vector<Slot> slots;
+	uint64_t requiredMask;
+	atomic<uint64_t> readyMask;
+
+	mutex waitMutex;
+	condition_variable ready;
+	bool closed;
+
+	T empty;
+	Merge merge;
+};
+
+// cpu time used by the calling thread, in ms
+double ThreadCpuMs() {
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// the producers sleep 200 ms instead of the 1 second of 6-StdTryLock.cpp
+void doSomeWork() { std::this_thread::sleep_for(std::chrono::milliseconds(200)); }
+
+                        /* 6-StdTryLock.cpp: busy spin */
+int X = 0, Y = 0;
+std::mutex m1, m2;
+
+void incrementXY(int& XorY, std::mutex& m, const char* desc) {
+	for (int i = 0; i < 5; ++i) {
+		m.lock();
+		++XorY;
+		cout << desc << XorY << '\n';
+		m.unlock();
+		doSomeWork();
+	}
+}
+
+double consumeXY() {
+	double cpuStart = ThreadCpuMs();
+	int useCount = 5;
+	int XplusY = 0;
+	while (1) {
+		int lockResult = std::try_lock(m1, m2);
+		if (lockResult == -1) {
+			if (X != 0 && Y != 0) {
+				--useCount;
+				XplusY += X + Y;
+				X = 0;
+				Y = 0;
+				cout << "XplusY " << XplusY << '\n';
+			}
+			m1.unlock();
+			m2.unlock();
+			if (useCount == 0) break;
+		}
+	}
+	return ThreadCpuMs() - cpuStart;
+}
+
+                        /* the same with the aggregator */
+enum Source { SourceX, SourceY };
+
+void produce(Aggregator<int>* agg, Source source, const char* desc) {
+	for (int i = 0; i < 5; ++i) {
+		agg->Publish(source, 1);		// ++X
+		cout << desc << "+1\n";
+		doSomeWork();
+	}
+}
+
+double consume(Aggregator<int>* agg) {
+	double cpuStart = ThreadCpuMs();
+	int XplusY = 0;
+	vector<int> snapshot;
+	while (agg->Take(snapshot)) {
+		XplusY += snapshot[SourceX] + snapshot[SourceY];
+		cout << "XplusY " << XplusY << '\n';
+	}
+	return ThreadCpuMs() - cpuStart;
+}
+
+int main() {
+	double spinCpu = 0;
+	{
+		std::thread t1(incrementXY, std::ref(X), std::ref(m1), "X ");
+		std::thread t2(incrementXY, std::ref(Y), std::ref(m2), "Y ");
+		std::thread t3([&] { spinCpu = consumeXY(); });
+		t1.join();
+		t2.join();
+		t3.join();
+	}
+
+	double waitCpu = 0;
+	{
+		Aggregator<int> agg(2, {SourceX, SourceY});
+		std::thread t1(produce, &agg, SourceX, "X ");
+		std::thread t2(produce, &agg, SourceY, "Y ");
+		std::thread t3([&] { waitCpu = consume(&agg); });
+		t1.join();
+		t2.join();
+		agg.Close();
+		t3.join();
+	}
+
+	cout << "consumer cpu time, busy spin with std::try_lock : " << spinCpu << " ms" << endl;
+	cout << "consumer cpu time, Aggregator::Take             : " << waitCpu << " ms" << endl;
+	return 0;
+}
@@ -0,0 +1,250 @@
+// TOPIC: Fair Queue Lock (CLH) With Deadline
+
+// NOTES:
+// 0. std::timed_mutex::try_lock_until in 7-TimedMurex.cpp gives no order: when the mutex is unlocked any
+//    waiting thread may get it, a thread which just unlocked often takes it again at once. Under load some
+//    threads win again and again while others wait until their deadline and fail (starvation).
+// 1. Queue lock: the waiting threads form a queue (FIFO), the lock is handed to them in arrival order.
+//    CLH lock (Craig, Landin, Hagersten):
+//    a. every acquire adds a node at the tail of the queue with one atomic exchange.
+//    b. the thread waits on the node of its predecessor only: every waiter spins on a different
+//       cache line (the nodes are cache line aligned), an unlock touches only the line of the next waiter.
+//    c. unlock() marks the own node as available, the successor sees it and owns the lock.
+// 2. Deadline (try_lock_until / try_lock_for), following Scott and Scherer ("Scalable queue-based spin
+//    locks with timeout"): a waiter whose deadline passes can't just leave, its successor waits on its node.
+//    a. if it is still the tail, it puts its predecessor back as tail (compare and swap) and frees its node.
+//    b. otherwise it writes its predecessor into its node: the successor sees this, skips the abandoned
+//       node (frees it) and waits on the predecessor instead. The queue order of the others is kept.
+// 3. Node ownership: a node is released by the thread which waited on it (its successor), so a node is never
+//    released while somebody spins on it. Like the classic CLH lock the nodes are recycled: after acquiring,
+//    a thread keeps its predecessor's node as its spare (thread_local) and uses it for its next acquire,
+//    so an acquire normally allocates nothing. Only after an abandoned wait a new node may be allocated.
+//    The destructor frees the tail, and the nodes an abandoned tail still links (2b) when no acquire
+//    came after the timeout to skip them.
+// 4. After a while of spinning the waiter also yields, so the lock still works when there are more threads
+//    than cores (the owner may need our core to reach unlock()).
+// 5. lock, unlock, try_lock, try_lock_for, try_lock_until: same names as std::timed_mutex.
+
+// To build: g++ -std=c++17 -O2 -pthread 19-QueueLock.cpp
+
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+using namespace std;
+using namespace std::chrono;
+
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+
+class ClhTimedLock {
+public:
+	ClhTimedLock() : tail(new Node(Available())), held(nullptr) {}
+	// like std::timed_mutex: must not be held or waited for. the tail may still be an abandoned node
+	// whose predecessors nobody skipped (no acquire came after the timeout), free that chain too
+	~ClhTimedLock() {
+		Node* n = tail.load();
+		while (n != nullptr && n != Available()) {
+			Node* p = n->prev.load();
+			delete n;
+			n = p;
+		}
+	}
+
+	ClhTimedLock(const ClhTimedLock&) = delete;
+	ClhTimedLock& operator=(const ClhTimedLock&) = delete;
+
+	void lock() {
+		try_lock_until(steady_clock::time_point::max());
+	}
+
+	bool try_lock() {
+		return try_lock_until(steady_clock::time_point::min());
+	}
+
+	template <typename Rep, typename Period>
+	bool try_lock_for(const duration<Rep, Period>& timeout) {
+		return try_lock_until(steady_clock::now() + timeout);
+	}
+
+	template <typename Clock, typename Duration>
+	bool try_lock_until(const time_point<Clock, Duration>& deadline) {
+		Node* me = TakeSpare();
+		Node* pred = tail.exchange(me, memory_order_acq_rel);
+
+		for (long spins = 0;; ++spins) {
+			Node* p = pred->prev.load(memory_order_acquire);
+			if (p == Available()) {
+				Recycle(pred);			// nobody uses it anymore, our next acquire will
+				held = me;
+				return true;
+			}
+			if (p != nullptr) {
+				// the predecessor gave up, wait on its predecessor
+				Recycle(pred);
+				pred = p;
+				continue;
+			}
+			if ((spins & 63) == 0 && Clock::now() >= deadline) {
+				Abandon(me, pred);
+				return false;
+			}
+			if (spins > 100)
+				this_thread::yield();
+			else
+				CpuRelax();
+		}
+	}
+
+	void unlock() {
+		Node* me = held;
+		held = nullptr;
+		me->prev.store(Available(), memory_order_release);		// the successor recycles it
+	}
+
+private:
+	// prev: nullptr = waiting or holding, Available() = unlocked, other = abandoned (its predecessor)
+	struct alignas(64) Node {
+		atomic<Node*> prev;
+		explicit Node(Node* p) : prev(p) {}
+	};
+
+	static Node* Available() {
+		static Node available(nullptr);
+		return &available;
+	}
+
+	// one spare node per thread, shared by all the locks (the nodes are all alike)
+	struct SpareNode {
+		Node* node = nullptr;
+		~SpareNode() { delete node; }
+	};
+
+	static SpareNode& Spare() {
+		static thread_local SpareNode spare;
+		return spare;
+	}
+
+	static Node* TakeSpare() {
+		Node* n = Spare().node;
+		if (n == nullptr)
+			return new Node(nullptr);
+		Spare().node = nullptr;
+		n->prev.store(nullptr, memory_order_relaxed);		// published by the exchange on tail
+		return n;
+	}
+
+	static void Recycle(Node* n) {
+		if (Spare().node == nullptr)
+			Spare().node = n;
+		else
+			delete n;			// a second free node, only after skipping an abandoned one
+	}
+
+	void Abandon(Node* me, Node* pred) {
+		Node* expected = me;
+		if (tail.compare_exchange_strong(expected, pred, memory_order_acq_rel))
+			Recycle(me);			// nobody behind us
+		else
+			me->prev.store(pred, memory_order_release);	// the successor skips us
+	}
+
+	alignas(64) atomic<Node*> tail;
+	Node* held;		// node of the owner, only used by the owner
+};
+
+// busy work of about ns nanoseconds (sleep_for would give the core away)
+void Work(long ns) {
+	auto end = steady_clock::now() + nanoseconds(ns);
+	while (steady_clock::now() < end) {}
+}
+
+struct Result {
+	vector<long> waitsNs;		// all the waits, successful or not
+	long acquired = 0;
+	long timeouts = 0;
+};
+
+int myAmount = 0;
+
+template <typename Lock>
+void increment(Lock* m, milliseconds deadline, atomic<bool>* stop, Result* r) {
+	while (!stop->load(memory_order_relaxed)) {
+		auto now = steady_clock::now();
+		bool ok = m->try_lock_until(now + deadline);
+		r->waitsNs.push_back(duration_cast<nanoseconds>(steady_clock::now() - now).count());
+		if (ok) {
+			++myAmount;
+			Work(2000);
+			m->unlock();
+			++r->acquired;
+		}
+		else
+			++r->timeouts;
+		Work(500);
+	}
+}
+
+template <typename Lock>
+void Benchmark(const char* name, unsigned threads, milliseconds deadline) {
+	Lock m;
+	myAmount = 0;
+	atomic<bool> stop(false);
+	vector<Result> results(threads);
+	vector<thread> workers;
+	for (unsigned t = 0; t < threads; ++t)
+		workers.emplace_back(increment<Lock>, &m, deadline, &stop, &results[t]);
+	this_thread::sleep_for(milliseconds(500));
+	stop = true;
+	for (thread& w : workers)
+		w.join();
+
+	vector<long> waits;
+	long acquired = 0, timeouts = 0, minAcquired = -1, maxAcquired = 0;
+	for (Result& r : results) {
+		waits.insert(waits.end(), r.waitsNs.begin(), r.waitsNs.end());
+		acquired += r.acquired;
+		timeouts += r.timeouts;
+		minAcquired = minAcquired < 0 ? r.acquired : min(minAcquired, r.acquired);
+		maxAcquired = max(maxAcquired, r.acquired);
+	}
+	sort(waits.begin(), waits.end());
+	auto pct = [&](double p) { return waits.empty() ? 0 : waits[(size_t)(p * (waits.size() - 1))] / 1000.0; };
+
+	cout << fixed << setprecision(1) << left << setw(18) << name << right << setw(4) << threads
+	     << setw(10) << pct(0.5) << setw(10) << pct(0.99) << setw(11) << waits.back() / 1000.0
+	     << setw(10) << acquired << setw(10) << timeouts << setw(8) << minAcquired << "/" << maxAcquired
+	     << (myAmount == acquired ? "" : "  WRONG COUNT") << endl;
+}
+
+int main() {
+	// 7-TimedMurex.cpp with the queue lock
+	ClhTimedLock lock;
+	auto now = steady_clock::now();
+	if (lock.try_lock_until(now + seconds(2))) {
+		cout << "Thread 1 Entered" << endl;
+		thread t2([&] {
+			cout << "Thread 2 " << (lock.try_lock_for(milliseconds(100)) ? "Entered" : "Couldn't Enter") << endl;
+		});
+		t2.join();
+		lock.unlock();
+	}
+
+	const milliseconds deadline(5);
+	cout << endl << left << setw(18) << "lock" << right << setw(4) << "thr" << setw(10) << "p50 us" << setw(10) << "p99 us"
+	     << setw(11) << "max us" << setw(10) << "acquired" << setw(10) << "timeouts" << setw(12) << "min/max thr" << endl;
+	for (unsigned threads : {2u, 4u, 8u}) {
+		Benchmark<timed_mutex>("std::timed_mutex", threads, deadline);
+		Benchmark<ClhTimedLock>("ClhTimedLock", threads, deadline);
+	}
+	return 0;
+}
@@ -0,0 +1,184 @@
+// TOPIC: Lightweight Reentrant Lock
+
+// NOTES:
+// 0. 8-Recursive_mutex.cpp locks a std::recursive_mutex 5 times in a loop. Every lock and unlock of
+//    std::recursive_mutex goes to pthread_mutex_lock/unlock with atomic instructions, also when the
+//    thread already owns it and only a counter has to change.
+// 1. ReentrantLock<Mutex> keeps two fields next to the real mutex:
+//    a. owner: an id of the owning thread (0 = nobody).
+//    b. depth: how many times the owner has locked it.
+//    lock(): if owner is the calling thread, ++depth and return: a plain increment, no atomic
+//            read-modify-write, no system call. Otherwise lock the real mutex once, then set owner
+//            and depth = 1.
+//    unlock(): --depth, only when depth reaches 0 the owner is cleared and the real mutex unlocked.
+// 2. Why a relaxed load of owner is enough: a thread only finds its own id in owner if it wrote it
+//    itself, and a thread always sees its own writes. Another thread may read an old value, but it is
+//    never equal to its own id, so it goes to the real mutex which does the real synchronization.
+//    depth is only touched by the owner, so it does not need to be atomic.
+// 3. The thread id is the address of a thread_local variable: unique among the running threads and
+//    cheaper to get than std::this_thread::get_id().
+// 4. The real mutex is FutexMutex by default (0 free, 1 locked, 2 locked with sleepers, see
+//    17-AdaptiveMutex.cpp), std::mutex works too: ReentrantLock<std::mutex>.
+// 5. Same rule as recursive_mutex: the owner must unlock as many times as it locked.
+
+// To build: g++ -std=c++17 -O2 -pthread 20-ReentrantLock.cpp   (linux)
+
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+using namespace std;
+using namespace std::chrono;
+
+class FutexMutex {
+public:
+	void lock() {
+		int c = 0;
+		if (state.compare_exchange_strong(c, 1, memory_order_acquire, memory_order_relaxed))
+			return;
+		if (c != 2)
+			c = state.exchange(2, memory_order_acquire);
+		while (c != 0) {
+			syscall(SYS_futex, reinterpret_cast<int*>(&state), FUTEX_WAIT_PRIVATE, 2, nullptr, nullptr, 0);
+			c = state.exchange(2, memory_order_acquire);
+		}
+	}
+
+	bool try_lock() {
+		int c = 0;
+		return state.compare_exchange_strong(c, 1, memory_order_acquire, memory_order_relaxed);
+	}
+
+	void unlock() {
+		if (state.exchange(0, memory_order_release) == 2)
+			syscall(SYS_futex, reinterpret_cast<int*>(&state), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+	}
+
+private:
+	atomic<int> state{0};
+};
+
+template <typename Mutex = FutexMutex>
+class ReentrantLock {
+public:
+	ReentrantLock() : owner(0), depth(0) {}
+	ReentrantLock(const ReentrantLock&) = delete;
+	ReentrantLock& operator=(const ReentrantLock&) = delete;
+
+	void lock() {
+		uintptr_t me = ThisThread();
+		if (owner.load(memory_order_relaxed) == me) {
+			++depth;
+			return;
+		}
+		m.lock();
+		owner.store(me, memory_order_relaxed);
+		depth = 1;
+	}
+
+	bool try_lock() {
+		uintptr_t me = ThisThread();
+		if (owner.load(memory_order_relaxed) == me) {
+			++depth;
+			return true;
+		}
+		if (!m.try_lock())
+			return false;
+		owner.store(me, memory_order_relaxed);
+		depth = 1;
+		return true;
+	}
+
+	void unlock() {
+		if (--depth == 0) {
+			owner.store(0, memory_order_relaxed);
+			m.unlock();
+		}
+	}
+
+	bool owned_by_this_thread() const { return owner.load(memory_order_relaxed) == ThisThread(); }
+
+private:
+	static uintptr_t ThisThread() {
+		static thread_local char tag;
+		return reinterpret_cast<uintptr_t>(&tag);
+	}
+
+	Mutex m;
+	atomic<uintptr_t> owner;
+	unsigned long depth;
+};
+
+// EXAMPLE 1 of 8-Recursive_mutex.cpp: recursion, counts instead of printing
+int buffer = 0;
+
+template <typename Lock>
+void recursion(Lock* m1, int loopFor) {
+	if (loopFor < 0)
+		return;
+	m1->lock();
+	++buffer;
+	recursion(m1, --loopFor);
+	m1->unlock();
+}
+
+// EXAMPLE 2 of 8-Recursive_mutex.cpp: lock 5 times, unlock 5 times, repeated
+template <typename Lock>
+double NestedNs(Lock* m1, long rounds) {
+	auto startTime = high_resolution_clock::now();
+	for (long r = 0; r < rounds; ++r) {
+		for (int i = 0; i < 5; i++)
+			m1->lock();
+		++buffer;
+		for (int i = 0; i < 5; i++)
+			m1->unlock();
+	}
+	return duration<double, nano>(high_resolution_clock::now() - startTime).count() / rounds;
+}
+
+template <typename Lock>
+bool Contended(unsigned threads, int times) {
+	Lock m1;
+	buffer = 0;
+	vector<thread> workers;
+	for (unsigned t = 0; t < threads; ++t)
+		workers.emplace_back([&] {
+			for (int i = 0; i < times; ++i)
+				recursion(&m1, 4);		// 5 nested locks per call
+		});
+	for (thread& w : workers)
+		w.join();
+	return buffer == (int)threads * times * 5;
+}
+
+int main() {
+	ReentrantLock<> m1;
+	for (int i = 0; i < 5; i++) {
+		m1.lock();
+		cout << "locked " << i << endl;
+	}
+	for (int i = 0; i < 5; i++) {
+		m1.unlock();
+		cout << "ulocked " << i << endl;
+	}
+
+	const long Rounds = 5000000;
+	recursive_mutex rm;
+	ReentrantLock<std::mutex> overStd;
+	double recursiveNs = NestedNs(&rm, Rounds);
+	double reentrantNs = NestedNs(&m1, Rounds);
+	double overStdNs = NestedNs(&overStd, Rounds);
+	cout << "5 nested lock/unlock, std::recursive_mutex      : " << recursiveNs << " ns" << endl;
+	cout << "5 nested lock/unlock, ReentrantLock<FutexMutex> : " << reentrantNs << " ns" << endl;
+	cout << "5 nested lock/unlock, ReentrantLock<std::mutex> : " << overStdNs << " ns" << endl;
+
+	cout << "4 threads, recursion, counts correct: "
+	     << Contended<recursive_mutex>(4, 100000) << " " << Contended<ReentrantLock<>>(4, 100000) << endl;
+	return 0;
+}
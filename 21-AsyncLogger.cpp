@@ -0,0 +1,412 @@
+// TOPIC: Asynchronous Logger
+
+// NOTES:
+// 0. 9-Lock_guard.cpp and 10-Unique_lock.cpp call cout while they hold m1. Writing to a terminal or a file
+//    takes microseconds (sometimes milliseconds), and all that time the other threads wait for m1:
+//    the I/O time becomes lock hold time.
+// 1. AsyncLogger takes the I/O out of the calling thread:
+//    a. every thread has its own ring buffer of fixed size records, created on its first log call.
+//       Only that thread writes to it and only the logger thread reads it (single producer single
+//       consumer), so a log call is a copy into the ring and one release store, no lock, no system call.
+//    b. a background thread drains all the rings and writes many records with one writev system call
+//       (one iovec per record, the records are not copied again).
+// 2. Backpressure, when a ring is full (the disk is slower than the threads log):
+//    a. Drop : the record is dropped and counted, the logger writes "N records dropped" later.
+//              The hot path never waits.
+//    b. Block: the thread waits until the logger thread made room. No record is lost while the logger
+//              thread runs, a record which still waits when it has stopped (logger being destroyed)
+//              is dropped instead of waiting forever.
+// 3. Flush(): waits until every record logged before the call is written (before exit, before a crash dump).
+// 4. Records are at most RecordSize - 1 bytes (longer ones are cut), a '\n' is added to each record.
+// 5. When a thread exits its ring is marked retired, the logger thread writes what is left and frees it.
+//    The thread only keeps a weak_ptr to its rings: when a logger is destroyed its rings are freed, and
+//    the thread forgets them the next time it needs a ring for a new logger.
+
+// To build: g++ -std=c++17 -O2 -pthread 21-AsyncLogger.cpp   (linux)
+
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstring>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdint>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <time.h>
+using namespace std;
+using namespace std::chrono;
+
+enum class Overflow { Drop, Block };
+
+class AsyncLogger {
+public:
+	static const size_t RecordSize = 128;
+
+	// fd: where the records are written (not closed by the logger), ringRecords: per thread, a power of 2
+	AsyncLogger(int fd, Overflow policy = Overflow::Drop, size_t ringRecords = 4096)
+		: fd(fd), policy(policy), ringRecords(ringRecords), id(NextId()), stop(false), flushRequested(0), flushed(0),
+		  writerExited(false) {
+		writer = thread(&AsyncLogger::WriterLoop, this);
+	}
+
+	~AsyncLogger() {
+		{
+			lock_guard<mutex> lock(m);
+			stop = true;
+		}
+		wake.notify_all();
+		writer.join();
+	}
+
+	AsyncLogger(const AsyncLogger&) = delete;
+	AsyncLogger& operator=(const AsyncLogger&) = delete;
+
+	// logs a preformatted record, the hot path
+	void Log(const char* text, size_t len) {
+		Ring* ring = MyRing();
+		char* slot = Reserve(ring);
+		if (slot == nullptr)
+			return;
+		len = min(len, RecordSize - sizeof(uint32_t) - 1);
+		memcpy(slot + sizeof(uint32_t), text, len);
+		Commit(ring, slot, len);
+	}
+
+	void Log(const char* text) { Log(text, strlen(text)); }
+
+	// printf like, formats directly into the ring
+	void Logf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+		Ring* ring = MyRing();
+		char* slot = Reserve(ring);
+		if (slot == nullptr)
+			return;
+		size_t room = RecordSize - sizeof(uint32_t);
+		va_list args;
+		va_start(args, format);
+		int n = vsnprintf(slot + sizeof(uint32_t), room, format, args);
+		va_end(args);
+		Commit(ring, slot, n < 0 ? 0 : min((size_t)n, room - 1));
+	}
+
+	// waits until everything logged before this call is written
+	void Flush() {
+		unique_lock<mutex> lock(m);
+		uint64_t ticket = ++flushRequested;
+		wake.notify_all();
+		done.wait(lock, [&] { return flushed >= ticket; });
+	}
+
+	long Dropped() const { return droppedTotal.load(memory_order_relaxed); }
+
+private:
+	struct Ring {
+		explicit Ring(size_t records) : mask(records - 1), data(new char[records * RecordSize]) {}
+
+		const size_t mask;
+		unique_ptr<char[]> data;
+		alignas(64) atomic<uint64_t> tail{0};		// written by the thread
+		uint64_t cachedHead = 0;					// thread's copy of head, read again only when full
+		atomic<long> dropped{0};
+		alignas(64) atomic<uint64_t> head{0};		// written by the logger thread
+		long droppedReported = 0;
+		atomic<bool> retired{false};
+
+		char* Slot(uint64_t i) { return data.get() + (i & mask) * RecordSize; }
+	};
+
+	// the rings of the calling thread, one per logger (usually one), retired when the thread exits.
+	// the logger owns the ring: while the logger is alive (we are inside one of its methods) the ring
+	// is too, so the raw pointer is enough on the hot path, weak tells if the logger is gone
+	struct ThreadRing {
+		uint64_t loggerId;
+		Ring* ring;
+		weak_ptr<Ring> weak;
+	};
+
+	struct ThreadRings {
+		vector<ThreadRing> rings;
+		~ThreadRings() {
+			for (ThreadRing& r : rings)
+				if (shared_ptr<Ring> ring = r.weak.lock())
+					ring->retired.store(true, memory_order_release);
+		}
+	};
+
+	static uint64_t NextId() {
+		static atomic<uint64_t> next(1);
+		return next.fetch_add(1);
+	}
+
+	Ring* MyRing() {
+		static thread_local ThreadRings mine;
+		for (ThreadRing& r : mine.rings)
+			if (r.loggerId == id)
+				return r.ring;
+
+		// first log call to this logger: forget the rings of destroyed loggers
+		for (size_t i = 0; i < mine.rings.size();) {
+			if (mine.rings[i].weak.expired()) {
+				mine.rings[i] = mine.rings.back();
+				mine.rings.pop_back();
+			}
+			else
+				++i;
+		}
+
+		// not make_shared: the weak_ptr would keep the ring's memory after the logger freed it
+		shared_ptr<Ring> ring(new Ring(ringRecords));
+		{
+			lock_guard<mutex> lock(m);
+			rings.push_back(ring);
+		}
+		mine.rings.push_back(ThreadRing{id, ring.get(), ring});
+		return ring.get();
+	}
+
+	char* Reserve(Ring* ring) {
+		uint64_t tail = ring->tail.load(memory_order_relaxed);
+		if (tail - ring->cachedHead > ring->mask) {
+			ring->cachedHead = ring->head.load(memory_order_acquire);
+			while (tail - ring->cachedHead > ring->mask) {
+				// nobody will make room once the logger thread is gone
+				if (policy == Overflow::Drop || writerExited.load(memory_order_acquire)) {
+					ring->dropped.fetch_add(1, memory_order_relaxed);
+					return nullptr;
+				}
+				wake.notify_one();
+				this_thread::yield();
+				ring->cachedHead = ring->head.load(memory_order_acquire);
+			}
+		}
+		return ring->Slot(tail);
+	}
+
+	void Commit(Ring* ring, char* slot, size_t len) {
+		slot[sizeof(uint32_t) + len] = '\n';
+		uint32_t stored = (uint32_t)len + 1;
+		memcpy(slot, &stored, sizeof(stored));
+		ring->tail.store(ring->tail.load(memory_order_relaxed) + 1, memory_order_release);
+	}
+
+	void WriteAll(iovec* iov, int count) {
+		while (count > 0) {
+			ssize_t n = writev(fd, iov, count);
+			if (n < 0) {
+				if (errno == EINTR)
+					continue;
+				return;			// nowhere to report it, the records are lost
+			}
+			// partial write: skip what was written
+			while (count > 0 && (size_t)n >= iov->iov_len) {
+				n -= iov->iov_len;
+				++iov;
+				--count;
+			}
+			if (count > 0) {
+				iov->iov_base = (char*)iov->iov_base + n;
+				iov->iov_len -= n;
+			}
+		}
+	}
+
+	// writes everything the rings have now, returns the number of records written
+	size_t Drain() {
+		vector<shared_ptr<Ring>> current;
+		{
+			lock_guard<mutex> lock(m);
+			current = rings;
+		}
+
+		size_t written = 0;
+		char notice[64];
+		for (shared_ptr<Ring>& ring : current) {
+			long dropped = ring->dropped.load(memory_order_relaxed);
+			if (dropped != ring->droppedReported) {
+				int n = snprintf(notice, sizeof(notice), "[logger] %ld records dropped\n", dropped - ring->droppedReported);
+				droppedTotal.fetch_add(dropped - ring->droppedReported, memory_order_relaxed);
+				ring->droppedReported = dropped;
+				iovec iov = { notice, (size_t)n };
+				WriteAll(&iov, 1);
+			}
+
+			uint64_t head = ring->head.load(memory_order_relaxed);
+			uint64_t tail = ring->tail.load(memory_order_acquire);
+			while (head < tail) {
+				int count = 0;
+				for (; head + count < tail && count < (int)batch.size(); ++count) {
+					char* slot = ring->Slot(head + count);
+					uint32_t len;
+					memcpy(&len, slot, sizeof(len));
+					batch[count].iov_base = slot + sizeof(uint32_t);
+					batch[count].iov_len = len;
+				}
+				WriteAll(batch.data(), count);
+				head += count;
+				written += count;
+				ring->head.store(head, memory_order_release);		// the thread may reuse the slots now
+			}
+		}
+
+		// forget the rings of finished threads once they are empty
+		lock_guard<mutex> lock(m);
+		for (size_t i = 0; i < rings.size();) {
+			Ring* r = rings[i].get();
+			if (r->retired.load(memory_order_acquire) && r->head.load() == r->tail.load(memory_order_acquire)) {
+				rings[i] = rings.back();
+				rings.pop_back();
+			}
+			else
+				++i;
+		}
+		return written;
+	}
+
+	void WriterLoop() {
+		batch.resize(IOV_MAX < 1024 ? IOV_MAX : 1024);
+		while (true) {
+			uint64_t ticket;
+			bool stopping;
+			{
+				unique_lock<mutex> lock(m);
+				wake.wait_for(lock, milliseconds(1), [&] { return stop || flushRequested > flushed; });
+				ticket = flushRequested;
+				stopping = stop;
+			}
+
+			Drain();
+
+			{
+				lock_guard<mutex> lock(m);
+				flushed = ticket;
+			}
+			done.notify_all();
+			if (stopping) {
+				Drain();
+				writerExited.store(true, memory_order_release);
+				return;
+			}
+		}
+	}
+
+	const int fd;
+	const Overflow policy;
+	const size_t ringRecords;
+	const uint64_t id;
+
+	mutex m;						// rings list, flush tickets, stop
+	vector<shared_ptr<Ring>> rings;
+	condition_variable wake;
+	condition_variable done;
+	bool stop;
+	uint64_t flushRequested;
+	uint64_t flushed;
+	atomic<long> droppedTotal{0};
+	atomic<bool> writerExited;
+
+	vector<iovec> batch;			// logger thread only
+	thread writer;
+};
+
+long ThreadCpuNs() {
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// task of 9-Lock_guard.cpp, measures how long m1 is held
+std::mutex m1;
+int buffer = 0;
+atomic<long> heldNs(0);
+
+void taskCout(const char* threadNumber, int loopFor, ostream* out) {
+	std::lock_guard<mutex> lock(m1);
+	auto start = steady_clock::now();
+	for (int i = 0; i < loopFor; ++i) {
+		buffer++;
+		*out << threadNumber << buffer << endl;
+	}
+	heldNs += duration_cast<nanoseconds>(steady_clock::now() - start).count();
+}
+
+void taskLogger(const char* threadNumber, int loopFor, AsyncLogger* log) {
+	std::lock_guard<mutex> lock(m1);
+	auto start = steady_clock::now();
+	for (int i = 0; i < loopFor; ++i) {
+		buffer++;
+		log->Logf("%s%d", threadNumber, buffer);
+	}
+	heldNs += duration_cast<nanoseconds>(steady_clock::now() - start).count();
+}
+
+int main() {
+	// 9-Lock_guard.cpp through the logger, written to stdout
+	{
+		AsyncLogger log(STDOUT_FILENO);
+		thread t1(taskLogger, "T0 ", 10, &log);
+		thread t2(taskLogger, "T1 ", 10, &log);
+		t1.join();
+		t2.join();
+		log.Flush();
+	}
+
+	// lock hold time: cout vs logger, both written to a file
+	const int Lines = 20000;
+	heldNs = 0;
+	{
+		ofstream fileOut("async_log_cout.txt");
+		thread t1(taskCout, "T0 ", Lines, &fileOut);
+		thread t2(taskCout, "T1 ", Lines, &fileOut);
+		t1.join();
+		t2.join();
+	}
+	double coutNs = heldNs / (2.0 * Lines);
+
+	int fd = open("async_log.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	heldNs = 0;
+	{
+		AsyncLogger log(fd, Overflow::Block);
+		thread t1(taskLogger, "T0 ", Lines, &log);
+		thread t2(taskLogger, "T1 ", Lines, &log);
+		t1.join();
+		t2.join();
+		log.Flush();
+	}
+	double loggerNs = heldNs / (2.0 * Lines);
+	cout << "m1 held per line, cout with endl : " << coutNs << " ns" << endl;
+	cout << "m1 held per line, AsyncLogger    : " << loggerNs << " ns" << endl;
+
+	// hot path: preformatted records from 4 threads, Drop policy, the rings are big enough for the burst
+	// (cpu time of the thread, wall time would also count the other threads when cores are shared)
+	{
+		AsyncLogger log(fd, Overflow::Drop, 1 << 16);
+		const int Records = 50000;
+		atomic<long> totalNs(0);
+		vector<thread> workers;
+		for (int t = 0; t < 4; ++t)
+			workers.emplace_back([&] {
+				const char msg[] = "order 42 filled at 101.25";
+				long start = ThreadCpuNs();
+				for (int i = 0; i < Records; ++i)
+					log.Log(msg, sizeof(msg) - 1);
+				totalNs += ThreadCpuNs() - start;
+			});
+		for (thread& w : workers)
+			w.join();
+		log.Flush();
+		cout << "Log() hot path: " << totalNs / (4.0 * Records) << " ns per record, dropped "
+		     << log.Dropped() << " of " << 4 * Records << endl;
+	}
+
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,459 @@
+// TOPIC: Bounded Multi Producer Multi Consumer Queue
+
+// NOTES:
+// 0. 11-ConditionVariable.cpp says that the best use of a condition variable is the producer/consumer
+//    problem, but both examples there only protect myAmount. This file implements it: producers push
+//    items into a queue, consumers pop them, and a thread waits when the queue is full or empty.
+// 1. A queue protected by one mutex (BaselineQueue below) makes every push and pop wait for the same lock.
+//    MpmcQueue<T> is Dmitry Vyukov's bounded MPMC queue:
+//    a. a ring of cells, every cell has a sequence number next to the item.
+//    b. a producer takes a position with one compare and swap on enqueuePos, a consumer with one compare
+//       and swap on dequeuePos. Producers and consumers use different counters and different cells.
+//    c. the sequence number tells whose turn a cell is: seq == pos means free for the producer of pos,
+//       seq == pos + 1 means full for the consumer of pos, and after the pop seq becomes pos + capacity,
+//       free for the producer of the next lap. No thread ever waits for a lock held by another thread.
+// 2. TryPush/TryPop never wait, they return false when the queue is full/empty.
+//    Push/Pop wait in a hybrid way: first spin a little with pause (the other side is usually
+//    only nanoseconds away), then yield, then sleep on a condition variable. The other side only touches
+//    the mutex and the condition variable when somebody sleeps, so the fast path has no lock.
+// 3. PushBatch/PopBatch move up to n items with one compare and swap, fewer atomic operations per item.
+// 4. Close(): Push returns false from now on, Pop returns false when the queue is empty, so the
+//    consumers know when to stop.
+// 5. The capacity is rounded up to a power of 2, T must be default constructible and movable.
+
+// To build: g++ -std=c++17 -O2 -pthread 22-MpmcQueue.cpp
+
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <queue>
+#include <chrono>
+#include <algorithm>
+#include <memory>
+#include <cstdint>
+using namespace std;
+using namespace std::chrono;
+
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+
+template <typename T>
+class MpmcQueue {
+public:
+	explicit MpmcQueue(size_t capacity)
+		: mask(RoundUpPow2(max<size_t>(capacity, 2)) - 1), cells(new Cell[mask + 1]),
+		  enqueuePos(0), dequeuePos(0), pushWaiters(0), popWaiters(0), closed(false) {
+		for (size_t i = 0; i <= mask; ++i)
+			cells[i].seq.store(i, memory_order_relaxed);
+	}
+
+	MpmcQueue(const MpmcQueue&) = delete;
+	MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+	size_t Capacity() const { return mask + 1; }
+
+	                        /* never wait */
+	template <typename U>
+	bool TryPush(U&& value) {
+		if (!Enqueue(std::forward<U>(value)))
+			return false;
+		Wake(popWaiters, notEmpty);
+		return true;
+	}
+
+	bool TryPop(T& out) {
+		if (!Dequeue(out))
+			return false;
+		Wake(pushWaiters, notFull);
+		return true;
+	}
+
+	// pushes up to n items with one compare and swap, returns how many
+	size_t TryPushBatch(T* items, size_t n) {
+		size_t k = EnqueueBatch(items, n);
+		if (k > 0)
+			Wake(popWaiters, notEmpty, true);
+		return k;
+	}
+
+	// pops up to n items with one compare and swap, returns how many
+	size_t TryPopBatch(T* out, size_t n) {
+		size_t k = DequeueBatch(out, n);
+		if (k > 0)
+			Wake(pushWaiters, notFull, true);
+		return k;
+	}
+
+	                        /* wait: spin, yield, then sleep */
+	// returns false if the queue is closed
+	template <typename U>
+	bool Push(U&& value) {
+		bool pushed = false;
+		Wait(pushWaiters, notFull, [&] { return closed.load() || (pushed = Enqueue(std::forward<U>(value))); });
+		if (pushed)
+			Wake(popWaiters, notEmpty);
+		return pushed;
+	}
+
+	// returns false once the queue is closed and empty
+	bool Pop(T& out) {
+		bool got = false;
+		Wait(popWaiters, notEmpty, [&] { return (got = Dequeue(out)) || closed.load(); });
+		if (!got)
+			got = Dequeue(out);		// closed, but an item may have arrived meanwhile
+		if (got)
+			Wake(pushWaiters, notFull);
+		return got;
+	}
+
+	// pushes all n items, returns false if the queue was closed
+	bool PushBatch(T* items, size_t n) {
+		size_t done = 0;
+		while (done < n) {
+			size_t k = 0;
+			Wait(pushWaiters, notFull, [&] { return closed.load() || (k = EnqueueBatch(items + done, n - done)) > 0; });
+			if (k == 0)
+				return false;
+			done += k;
+			Wake(popWaiters, notEmpty, true);
+		}
+		return true;
+	}
+
+	// waits for at least one item and pops up to n, returns 0 once closed and empty (or at once for n == 0)
+	size_t PopBatch(T* out, size_t n) {
+		if (n == 0)
+			return 0;
+		size_t got = 0;
+		Wait(popWaiters, notEmpty, [&] { return (got = DequeueBatch(out, n)) > 0 || closed.load(); });
+		if (got == 0)
+			got = DequeueBatch(out, n);
+		if (got > 0)
+			Wake(pushWaiters, notFull, true);
+		return got;
+	}
+
+	void Close() {
+		lock_guard<mutex> lock(m);
+		closed.store(true);
+		notFull.notify_all();
+		notEmpty.notify_all();
+	}
+
+private:
+	struct Cell {
+		atomic<size_t> seq;
+		T data;
+	};
+
+	static size_t RoundUpPow2(size_t n) {
+		size_t p = 1;
+		while (p < n)
+			p <<= 1;
+		return p;
+	}
+
+	// Vyukov: claim a position with a compare and swap, then publish the cell with its sequence number
+	template <typename U>
+	bool Enqueue(U&& value) {
+		size_t pos = enqueuePos.load(memory_order_relaxed);
+		Cell* cell;
+		while (true) {
+			cell = &cells[pos & mask];
+			size_t seq = cell->seq.load(memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+			if (diff == 0) {
+				if (enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+				return false;		// full: the cell of this position is not popped yet
+			else
+				pos = enqueuePos.load(memory_order_relaxed);
+		}
+		cell->data = std::forward<U>(value);
+		cell->seq.store(pos + 1, memory_order_release);
+		return true;
+	}
+
+	bool Dequeue(T& out) {
+		size_t pos = dequeuePos.load(memory_order_relaxed);
+		Cell* cell;
+		while (true) {
+			cell = &cells[pos & mask];
+			size_t seq = cell->seq.load(memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+			if (diff == 0) {
+				if (dequeuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+				return false;		// empty
+			else
+				pos = dequeuePos.load(memory_order_relaxed);
+		}
+		out = std::move(cell->data);
+		cell->seq.store(pos + mask + 1, memory_order_release);
+		return true;
+	}
+
+	// the k cells after pos are checked one by one (consumers may free them out of order), then claimed at once
+	size_t EnqueueBatch(T* items, size_t n) {
+		if (n == 0)
+			return 0;		// the scan below would stop at k == 0 and take it for a lost race
+		size_t pos = enqueuePos.load(memory_order_relaxed);
+		size_t k;
+		while (true) {
+			for (k = 0; k < n && k <= mask; ++k)
+				if (cells[(pos + k) & mask].seq.load(memory_order_acquire) != pos + k)
+					break;
+			if (k == 0) {
+				// full, unless another producer took pos meanwhile
+				if ((intptr_t)cells[pos & mask].seq.load(memory_order_acquire) - (intptr_t)pos < 0)
+					return 0;
+				pos = enqueuePos.load(memory_order_relaxed);
+				continue;
+			}
+			if (enqueuePos.compare_exchange_weak(pos, pos + k, memory_order_relaxed))
+				break;
+		}
+		for (size_t i = 0; i < k; ++i) {
+			Cell& cell = cells[(pos + i) & mask];
+			cell.data = std::move(items[i]);
+			cell.seq.store(pos + i + 1, memory_order_release);
+		}
+		return k;
+	}
+
+	size_t DequeueBatch(T* out, size_t n) {
+		if (n == 0)
+			return 0;
+		size_t pos = dequeuePos.load(memory_order_relaxed);
+		size_t k;
+		while (true) {
+			for (k = 0; k < n && k <= mask; ++k)
+				if (cells[(pos + k) & mask].seq.load(memory_order_acquire) != pos + k + 1)
+					break;
+			if (k == 0) {
+				// empty, unless another consumer took pos meanwhile
+				if ((intptr_t)cells[pos & mask].seq.load(memory_order_acquire) - (intptr_t)(pos + 1) < 0)
+					return 0;
+				pos = dequeuePos.load(memory_order_relaxed);
+				continue;
+			}
+			if (dequeuePos.compare_exchange_weak(pos, pos + k, memory_order_relaxed))
+				break;
+		}
+		for (size_t i = 0; i < k; ++i) {
+			Cell& cell = cells[(pos + i) & mask];
+			out[i] = std::move(cell.data);
+			cell.seq.store(pos + i + mask + 1, memory_order_release);
+		}
+		return k;
+	}
+
+	// attempt() returns true when done, it must not call Wake (m is held while sleeping)
+	template <typename Attempt>
+	void Wait(atomic<int>& waiters, condition_variable& cv, Attempt attempt) {
+		for (int i = 0; i < 64; ++i) {
+			if (attempt())
+				return;
+			CpuRelax();
+		}
+		for (int i = 0; i < 16; ++i) {
+			if (attempt())
+				return;
+			this_thread::yield();
+		}
+
+		unique_lock<mutex> lock(m);
+		while (true) {
+			waiters.fetch_add(1, memory_order_relaxed);
+			// pairs with the fence in Wake: either we see the change or the other side sees us
+			atomic_thread_fence(memory_order_seq_cst);
+			bool done = attempt();
+			if (!done)
+				cv.wait(lock);
+			waiters.fetch_sub(1, memory_order_relaxed);
+			if (done)
+				return;
+		}
+	}
+
+	void Wake(atomic<int>& waiters, condition_variable& cv, bool all = false) {
+		atomic_thread_fence(memory_order_seq_cst);
+		if (waiters.load(memory_order_relaxed) > 0) {
+			lock_guard<mutex> lock(m);
+			if (all)
+				cv.notify_all();
+			else
+				cv.notify_one();
+		}
+	}
+
+	const size_t mask;
+	unique_ptr<Cell[]> cells;
+	alignas(64) atomic<size_t> enqueuePos;
+	alignas(64) atomic<size_t> dequeuePos;
+	alignas(64) atomic<int> pushWaiters;
+	atomic<int> popWaiters;
+	atomic<bool> closed;
+	mutex m;
+	condition_variable notFull;
+	condition_variable notEmpty;
+};
+
+// std::queue + one mutex + two condition variables, the textbook version of 11-ConditionVariable.cpp
+template <typename T>
+class BaselineQueue {
+public:
+	explicit BaselineQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+	bool Push(T value) {
+		unique_lock<mutex> lock(m);
+		notFull.wait(lock, [&] { return q.size() < capacity || closed; });
+		if (closed)
+			return false;
+		q.push(std::move(value));
+		notEmpty.notify_one();
+		return true;
+	}
+
+	bool Pop(T& out) {
+		unique_lock<mutex> lock(m);
+		notEmpty.wait(lock, [&] { return !q.empty() || closed; });
+		if (q.empty())
+			return false;
+		out = std::move(q.front());
+		q.pop();
+		notFull.notify_one();
+		return true;
+	}
+
+	void Close() {
+		lock_guard<mutex> lock(m);
+		closed = true;
+		notFull.notify_all();
+		notEmpty.notify_all();
+	}
+
+private:
+	size_t capacity;
+	queue<T> q;
+	mutex m;
+	condition_variable notFull;
+	condition_variable notEmpty;
+	bool closed;
+};
+
+long NowNs() {
+	return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// every item is the time it was pushed, the consumers record now - item
+template <typename Queue, bool Batch>
+void Run(const char* name, unsigned producers, unsigned consumers, long items) {
+	Queue q(1024);
+	long perProducer = items / producers;
+	vector<vector<long>> latencies(consumers);
+	atomic<long> popped(0);
+	const size_t BatchSize = 32;
+
+	auto startTime = steady_clock::now();
+	vector<thread> threads;
+	for (unsigned c = 0; c < consumers; ++c)
+		threads.emplace_back([&, c] {
+			vector<long>& lat = latencies[c];
+			lat.reserve(items / consumers + BatchSize);
+			long got = 0;
+			if constexpr (Batch) {
+				long buffer[BatchSize];
+				size_t n;
+				while ((n = q.PopBatch(buffer, BatchSize)) > 0) {
+					long now = NowNs();
+					for (size_t i = 0; i < n; ++i)
+						lat.push_back(now - buffer[i]);
+					got += n;
+				}
+			}
+			else {
+				long item;
+				while (q.Pop(item)) {
+					lat.push_back(NowNs() - item);
+					++got;
+				}
+			}
+			popped += got;
+		});
+
+	vector<thread> producerThreads;
+	for (unsigned p = 0; p < producers; ++p)
+		producerThreads.emplace_back([&] {
+			if constexpr (Batch) {
+				long buffer[BatchSize];
+				for (long i = 0; i < perProducer; i += BatchSize) {
+					size_t n = (size_t)min<long>(BatchSize, perProducer - i);
+					long now = NowNs();
+					for (size_t k = 0; k < n; ++k)
+						buffer[k] = now;
+					q.PushBatch(buffer, n);
+				}
+			}
+			else {
+				for (long i = 0; i < perProducer; ++i)
+					q.Push(NowNs());
+			}
+		});
+	for (thread& p : producerThreads)
+		p.join();
+	q.Close();
+	for (thread& c : threads)
+		c.join();
+	double seconds = duration<double>(steady_clock::now() - startTime).count();
+
+	vector<long> all;
+	for (vector<long>& l : latencies)
+		all.insert(all.end(), l.begin(), l.end());
+	sort(all.begin(), all.end());
+	auto pct = [&](double p) { return all.empty() ? 0.0 : all[(size_t)(p * (all.size() - 1))] / 1000.0; };
+
+	cout << fixed << setprecision(1) << left << setw(16) << name << right << setw(3) << producers << "/" << left
+	     << setw(3) << consumers << right << setw(12) << popped / seconds / 1e6 << setw(11) << pct(0.5)
+	     << setw(11) << pct(0.99) << (popped == perProducer * producers ? "" : "  LOST ITEMS") << endl;
+}
+
+int main() {
+	// producer/consumer of 11-ConditionVariable.cpp: one producer adds money, one consumer takes it
+	MpmcQueue<int> amounts(16);
+	int myAmount = 0;
+	thread consumer([&] {
+		int amount;
+		while (amounts.Pop(amount))
+			myAmount += amount;
+	});
+	for (int i = 1; i <= 100; ++i)
+		amounts.Push(i);
+	amounts.Close();
+	consumer.join();
+	cout << "myAmount: " << myAmount << " (expected 5050)" << endl << endl;
+
+	const long Items = 1000000;
+	cout << left << setw(16) << "queue" << right << setw(7) << "P/C" << setw(12) << "M items/s"
+	     << setw(11) << "p50 us" << setw(11) << "p99 us" << endl;
+	unsigned configs[][2] = { {1, 1}, {2, 2}, {4, 4}, {1, 4}, {4, 1} };
+	for (auto& pc : configs) {
+		Run<BaselineQueue<long>, false>("mutex + cv", pc[0], pc[1], Items);
+		Run<MpmcQueue<long>, false>("MpmcQueue", pc[0], pc[1], Items);
+		Run<MpmcQueue<long>, true>("MpmcQueue x32", pc[0], pc[1], Items);
+	}
+	return 0;
+}
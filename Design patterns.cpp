@@ -61,48 +61,6 @@ the existing code for the elements or the object structure.
 #include <iostream>
 #include <string>
 
-// Product class
-class Pizza {
-public:
-    void setDough(const std::string& dough)
-    {
-        this->dough = dough;
-    }
-
-    void setSauce(const std::string& sauce)
-    {
-        this->sauce = sauce;
-    }
-
-    void setTopping(const std::string& topping)
-    {
-        this->topping = topping;
-    }
-
-    void displayPizza() const
-    {
-        std::cout << "Pizza with Dough: " << dough
-                  << ", Sauce: " << sauce
-                  << ", Topping: " << topping << std::endl;
-    }
-
-private:
-    std::string dough;
-    std::string sauce;
-    std::string topping;
-};
-
-// Abstract builder class
-class PizzaBuilder {
-public:
-    virtual void buildDough() = 0;
-    virtual void buildSauce() = 0;
-    virtual void buildTopping() = 0;
-    virtual Pizza getPizza() const = 0;
-};
-
-// Concrete builder for a specific type of pizza
-
 /*
 In this example:
 
@@ -115,63 +73,7 @@ taking a builder and calling the necessary build methods to create a pizza.
 In the "main" function, we create instances of different builders and use the Cook class to build pizzas
  with specific characteristics.I
  */
-class HawaiianPizzaBuilder : public PizzaBuilder {
-public:
-    void buildDough() override
-    {
-        pizza.setDough("Pan Dough");
-    }
-
-    void buildSauce() override
-    {
-        pizza.setSauce("Hawaiian Sauce");
-    }
-
-    void buildTopping() override
-    {
-        pizza.setTopping("Ham and Pineapple");
-    }
-
-    Pizza getPizza() const override { return pizza; }
-
-private:
-    Pizza pizza;
-};
-
-// Concrete builder for another type of pizza
-class SpicyPizzaBuilder : public PizzaBuilder {
-public:
-    void buildDough() override
-    {
-        pizza.setDough("Thin Dough");
-    }
-
-    void buildSauce() override
-    {
-        pizza.setSauce("Spicy Tomato Sauce");
-    }
-
-    void buildTopping() override
-    {
-        pizza.setTopping("Pepperoni and Jalapenos");
-    }
-
-    Pizza getPizza() const override { return pizza; }
-
-private:
-    Pizza pizza;
-};
-
-// Director class that orchestrates the construction
-class Cook {
-public:
-    void makePizza(PizzaBuilder& builder)
-    {
-        builder.buildDough();
-        builder.buildSauce();
-        builder.buildTopping();
-    }
-};
+#include "pizza_builder.h"     // Pizza, PizzaBuilder, HawaiianPizzaBuilder, SpicyPizzaBuilder, Cook
 
 int main()
 {
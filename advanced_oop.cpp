@@ -122,6 +122,7 @@ in classical inheritance, a derived class can only access public and protected m
 #include <cassert>
 #include <sstream>
 #include <ostream>
+#include "matrix.h"
 
 using std::cout;
 using std::string;
@@ -377,61 +378,8 @@ class HumanNeeds
 };
 
                          /* operator overloading */
-class Matrix
-{
-       public:
-       Matrix (int rows, int cols): rows_(rows), cols_(cols), values_(rows * cols)
-       {
-
-       }
-
-                   // overload parenthese operator to access the elements
-       // overload parentheses operator for non const access
-       int& operator() (int row,int col)
-       {
-              return values_[row * cols_ + col];
-       }
-
-       // overload parentheses operator for const access
-       int operator() (int row, int col) const
-       {
-              return values_[row * cols_ + col];
-       }
-       // overload + operator for matrix addition
-       //Prevents modification of the original matrices during addition
-       Matrix operator + (const Matrix m) const
-       {
-              Matrix result(rows_, cols_);
-
-             // Adds corresponding elements and stores the result in a new matrix.
-              for (size_t i = 0; i < values_.size(); ++i) 
-              {
-                     result.values_[i] = values_[i] + m.values_[i];
-              }
-              return result;
-       }
-
-       // Function to display the matrix
-       void display() const
-       {
-              for (int i = 0; i < rows_; ++i) 
-              {
-                     for (int j = 0; j < cols_; ++j) 
-                     {
-                            //Uses the overloaded () operator for element access.
-                             std::cout << (*this)(i, j) << " ";
-                     }
-                     std::cout << std::endl;
-              }
-       }
-       
-       private:
-       int rows_;
-       int cols_;
-       // used for storage
-       std::vector<int> values_;
-
-};
+// Matrix (matrix.h): overloads () for element access and + for addition
+// its storage comes from a std::pmr::memory_resource, the default heap unless one is given
 
 /* usecase: vector addition on a pair of points to add their x and y components
                 the compiler won't recognize this because this data is user defined,
@@ -0,0 +1,96 @@
+/*
+- Board file: one row per line, numbers followed by a comma "0,1,0,"
+              ReadBoardFile() reads it into a 2D vector, used by intro.cpp (reading data from a file),
+              memory_hugepage_arena.cpp and memory_weak_cache.cpp.
+
+- Memory resource: the second ParseLine/ReadBoardFile pair builds std::pmr vectors, the rows and
+                   the outer vector are allocated from the given resource (an arena for example)
+                   instead of new/delete.
+*/
+
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <fstream>
+#include <memory_resource>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Function to process a string and save it in a vector and return it
+inline std::vector <int> ParseLine (std::string MyString)
+{
+    std::istringstream MyStream(MyString);
+
+    char c;
+    int n;
+    std::vector <int> v;
+
+    while (MyStream >> n >> c)
+    {
+        v.push_back(n);
+    }
+
+    return v;
+}
+
+/* function to read board file and process each line using the ParseLine function,
+then finally, put the output of the file in a 2D vector  */
+inline std::vector <std::vector <int>> ReadBoardFile (std::string path)
+{
+    std::ifstream MyFile (path);
+
+    std::vector < std::vector <int>> board{};
+
+    if (MyFile)
+    {
+        std::string line;
+
+        while (getline(MyFile,line))
+        {
+            std::vector <int> row = ParseLine(line);
+            board.push_back(row);
+        }
+
+    }
+  return board;
+}
+
+                         /* the same with a memory resource */
+inline std::pmr::vector <int> ParseLine (const std::string& MyString, std::pmr::memory_resource* resource)
+{
+    std::istringstream MyStream(MyString);
+
+    char c;
+    int n;
+    std::pmr::vector <int> v(resource);
+
+    while (MyStream >> n >> c)
+    {
+        v.push_back(n);
+    }
+
+    return v;
+}
+
+inline std::pmr::vector <std::pmr::vector <int>> ReadBoardFile (const std::string& path, std::pmr::memory_resource* resource)
+{
+    std::ifstream MyFile (path);
+
+    std::pmr::vector < std::pmr::vector <int>> board(resource);
+
+    if (MyFile)
+    {
+        std::string line;
+
+        while (getline(MyFile,line))
+        {
+            // same resource on both sides, so the row is moved, not copied
+            board.push_back(ParseLine(line, resource));
+        }
+
+    }
+  return board;
+}
+
+#endif
@@ -0,0 +1,273 @@
+/*
+- CompactingHeap: the handle based heap of memory_compacting_heap.cpp, the blocks are moved by
+                  the incremental compaction (CompactStep) and found again through their handles.
+                  also used by memory_alloc_benchmark.cpp.
+*/
+
+#ifndef COMPACTING_HEAP_H
+#define COMPACTING_HEAP_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+class CompactingHeap
+{
+    public:
+    typedef uint32_t Handle;
+    static const Handle Null = 0xFFFFFFFFu;
+
+    struct Stats
+    {
+        size_t usedSpan;        // from the region start to the end of the last block
+        size_t liveBytes;       // payload + headers of live blocks
+        size_t residentBytes;   // pages really in RAM
+        double fragmentation;
+    };
+
+    explicit CompactingHeap(size_t capacity)
+        : _capacity(RoundToPages(capacity)), _top(0), _live(0),
+          _compacting(false), _scan(0), _write(0)
+    {
+        void* p = mmap(NULL, _capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            throw std::bad_alloc();
+        _base = (char*) p;
+    }
+
+    CompactingHeap(const CompactingHeap&) = delete;
+    CompactingHeap& operator= (const CompactingHeap&) = delete;
+
+    ~CompactingHeap()
+    {
+        munmap(_base, _capacity);
+    }
+
+    // like malloc
+    Handle Allocate(size_t size)
+    {
+        // also keeps RoundUp below from wrapping around for huge sizes
+        if (size > _capacity)
+            throw std::bad_alloc();
+        size_t need = sizeof(Header) + RoundUp(size, Align);
+        if (_top + need > _capacity)
+        {
+            // out of space: finish the compaction and try again
+            while (!CompactStep(_capacity)) {}
+            if (_top + need > _capacity)
+                throw std::bad_alloc();
+        }
+
+        uint32_t index = NewEntry();
+        Header* h = (Header*) (_base + _top);
+        h->index = index;
+        h->size = size;
+        _entries[index].offset = _top;
+        _top += need;
+        _live += need;
+        return MakeHandle(index);
+    }
+
+    // like calloc
+    Handle AllocateZeroed(size_t size)
+    {
+        Handle handle = Allocate(size);
+        memset(Get(handle), 0, size);
+        return handle;
+    }
+
+    // like realloc, the handle stays the same
+    void Reallocate(Handle handle, size_t size)
+    {
+        uint32_t index = Index(handle);
+        Header* old = At(index);
+        size_t keep = old->size < size ? old->size : size;
+
+        Handle tmp = Allocate(size);
+        uint32_t tmpIndex = Index(tmp);
+        old = At(index);    // Allocate may have moved the block
+        memcpy(Payload(At(tmpIndex)), Payload(old), keep);
+
+        // swap the table entries so that the caller's handle points to the new block
+        std::swap(_entries[index].offset, _entries[tmpIndex].offset);
+        At(index)->index = index;
+        At(tmpIndex)->index = tmpIndex;
+        Free(MakeHandle(tmpIndex));
+    }
+
+    // like free
+    void Free(Handle handle)
+    {
+        uint32_t index = Index(handle);
+        Header* h = At(index);
+        _live -= sizeof(Header) + RoundUp(h->size, Align);
+        h->index = Dead;
+
+        _entries[index].offset = FreeMark;
+        ++_entries[index].generation;
+        _freeEntries.push_back(index);
+    }
+
+    // current address of the block, valid until the next compaction step
+    void* Get(Handle handle)
+    {
+        return Payload(At(Index(handle)));
+    }
+
+    size_t Size(Handle handle)
+    {
+        return At(Index(handle))->size;
+    }
+
+    // handle of the block at p (an address given by Get)
+    Handle HandleOf(void* p) const
+    {
+        return MakeHandle(((Header*) p - 1)->index);
+    }
+
+    // true if Allocate (size) finds the space without compacting first (no block is moved)
+    bool Fits(size_t size) const
+    {
+        return size <= _capacity && _top + sizeof(Header) + RoundUp(size, Align) <= _capacity;
+    }
+
+    // moves at most maxBytes of live blocks, returns true when the pass is finished
+    bool CompactStep(size_t maxBytes)
+    {
+        if (!_compacting)
+        {
+            _compacting = true;
+            _scan = 0;
+            _write = 0;
+        }
+
+        size_t moved = 0;
+        while (_scan < _top && moved < maxBytes)
+        {
+            Header* h = (Header*) (_base + _scan);
+            size_t blockSize = sizeof(Header) + RoundUp(h->size, Align);
+            if (h->index != Dead)
+            {
+                if (_scan != _write)
+                {
+                    memmove(_base + _write, h, blockSize);
+                    _entries[((Header*) (_base + _write))->index].offset = _write;
+                    moved += blockSize;
+                }
+                _write += blockSize;
+            }
+            _scan += blockSize;
+        }
+
+        if (_scan < _top)
+            return false;
+
+        // pass finished: give back the whole pages above the new top
+        size_t oldTop = _top;
+        _top = _write;
+        _compacting = false;
+        size_t from = RoundToPages(_top);
+        size_t to = RoundToPages(oldTop);
+        if (to > from)
+            madvise(_base + from, to - from, MADV_DONTNEED);
+        return true;
+    }
+
+    Stats GetStats() const
+    {
+        Stats s;
+        s.usedSpan = _top;
+        s.liveBytes = _live;
+        s.fragmentation = _top ? 1.0 - (double) _live / _top : 0.0;
+
+        size_t pages = _capacity / PageSize();
+        std::vector<unsigned char> in(pages);
+        s.residentBytes = 0;
+        if (mincore(_base, _capacity, in.data()) == 0)
+            for (unsigned char c : in)
+                s.residentBytes += (c & 1) ? PageSize() : 0;
+        return s;
+    }
+
+    private:
+    static const uint32_t Dead = 0xFFFFFFFFu;
+    static const size_t FreeMark = (size_t) -1;
+    static const size_t Align = 16;
+
+    struct Header
+    {
+        uint32_t index;     // handle table index, Dead for freed blocks
+        uint32_t pad;       // keeps size 8 bytes and the payload 16 bytes aligned
+        uint64_t size;      // payload size asked by the caller, may be 4 GB or more
+    };
+
+    struct Entry
+    {
+        size_t offset;
+        uint8_t generation;
+    };
+
+    static size_t PageSize()
+    {
+        static const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+        return page;
+    }
+
+    static size_t RoundUp(size_t n, size_t to) { return (n + to - 1) / to * to; }
+    static size_t RoundToPages(size_t n) { return RoundUp(n, PageSize()); }
+
+    Handle MakeHandle(uint32_t index) const
+    {
+        return (Handle) _entries[index].generation << 24 | index;
+    }
+
+    // checks the generation, an old handle of a reused entry is a bug in the caller
+    uint32_t Index(Handle handle) const
+    {
+        uint32_t index = handle & 0xFFFFFF;
+        if (index >= _entries.size() || (uint8_t) (handle >> 24) != _entries[index].generation
+            || _entries[index].offset == FreeMark)
+        {
+            fprintf(stderr, "CompactingHeap: invalid handle %u\n", handle);
+            abort();
+        }
+        return index;
+    }
+
+    uint32_t NewEntry()
+    {
+        if (!_freeEntries.empty())
+        {
+            uint32_t index = _freeEntries.back();
+            _freeEntries.pop_back();
+            return index;
+        }
+        if (_entries.size() == 0xFFFFFF)
+            throw std::bad_alloc();
+        _entries.push_back(Entry{FreeMark, 0});
+        return (uint32_t) _entries.size() - 1;
+    }
+
+    Header* At(uint32_t index) { return (Header*) (_base + _entries[index].offset); }
+    static void* Payload(Header* h) { return h + 1; }
+
+    char* _base;
+    size_t _capacity;
+    size_t _top;
+    size_t _live;
+    std::vector<Entry> _entries;
+    std::vector<uint32_t> _freeEntries;
+
+    // incremental compaction state
+    bool _compacting;
+    size_t _scan;
+    size_t _write;
+};
+
+#endif
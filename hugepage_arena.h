@@ -0,0 +1,129 @@
+/*
+- HugePageArena: the bump allocator of memory_hugepage_arena.cpp on a 2 MB aligned region
+                 (MAP_HUGETLB, or THP with madvise), a std::pmr::memory_resource.
+                 also used by memory_alloc_benchmark.cpp.
+*/
+
+#ifndef HUGEPAGE_ARENA_H
+#define HUGEPAGE_ARENA_H
+
+#include <stdio.h>
+#include <sys/mman.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <memory_resource>
+#include <cstdint>
+#include <new>
+
+class HugePageArena : public std::pmr::memory_resource
+{
+    public:
+    static const size_t HugePageSize = 2 * 1024 * 1024;
+
+    explicit HugePageArena(size_t bytes)
+        : _base(NULL), _size(RoundUp(bytes, HugePageSize)), _used(0), _explicit(false)
+    {
+#ifdef MAP_HUGETLB
+        // 1- explicit huge pages if the pool has enough of them
+        void* p = mmap(NULL, _size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+        {
+            _base = (char*) p;
+            _explicit = true;
+            return;
+        }
+#endif
+        // 2- normal pages, aligned to 2 MB so that THP can use them, plus madvise
+        size_t reserve = _size + HugePageSize;
+        void* raw = mmap(NULL, reserve, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED)
+            throw std::bad_alloc();
+
+        uintptr_t start = RoundUp((uintptr_t) raw, HugePageSize);
+        size_t head = start - (uintptr_t) raw;
+        // give back the unaligned head and tail
+        if (head != 0)
+            munmap(raw, head);
+        if (reserve - head - _size != 0)
+            munmap((char*) start + _size, reserve - head - _size);
+        _base = (char*) start;
+
+#ifdef MADV_HUGEPAGE
+        madvise(_base, _size, MADV_HUGEPAGE);
+#endif
+    }
+
+    HugePageArena(const HugePageArena&) = delete;
+    HugePageArena& operator= (const HugePageArena&) = delete;
+
+    ~HugePageArena()
+    {
+        munmap(_base, _size);
+    }
+
+    size_t Capacity() const { return _size; }
+    size_t Used() const { return _used; }
+    bool ExplicitHugePages() const { return _explicit; }
+
+    // bytes of the region which are backed by huge pages right now
+    size_t HugeBytes() const
+    {
+        if (_explicit)
+            return _size;
+
+        std::ifstream smaps("/proc/self/smaps");
+        std::string line;
+        uintptr_t begin = (uintptr_t) _base, end = begin + _size;
+        bool inside = false;
+        size_t total = 0;
+        while (std::getline(smaps, line))
+        {
+            unsigned long from, to;
+            if (sscanf(line.c_str(), "%lx-%lx ", &from, &to) == 2)
+            {
+                inside = from < end && to > begin;
+                continue;
+            }
+            if (inside && line.compare(0, 14, "AnonHugePages:") == 0)
+            {
+                std::istringstream in(line.substr(14));
+                size_t kb = 0;
+                in >> kb;
+                total += kb * 1024;
+            }
+        }
+        return total;
+    }
+
+    private:
+    static size_t RoundUp(size_t n, size_t to)
+    {
+        return (n + to - 1) / to * to;
+    }
+
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        size_t start = RoundUp(_used, alignment);
+        if (start + bytes > _size)
+            throw std::bad_alloc();
+        _used = start + bytes;
+        return _base + start;
+    }
+
+    // arena: single pieces are released with the whole region
+    void do_deallocate(void*, size_t, size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    char* _base;
+    size_t _size;
+    size_t _used;
+    bool _explicit;
+};
+
+#endif
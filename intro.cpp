@@ -75,6 +75,7 @@ Auto keyword: compiler can determine the variable type based on the value
 #include <string>
 /* to use istringstream  to process each line and store the data*/
 #include <sstream>
+#include "board.h"
 
 using std::vector;
 using std::cout;
@@ -115,44 +116,8 @@ int Addition (const vector <int> &v)
     return sum;
 }
 
-// Function to process a string and save it in a vector and return it
-vector <int> ParseLine (string MyString)
-{
-    istringstream MyStream(MyString);
-
-    char c;
-    int n;
-    vector <int> v;
-
-    while (MyStream >> n >> c)
-    {
-        v.push_back(n);
-    }
-
-    return v;
-}
-
-/* function to read board file and process each line using the ParseLine function, 
-then finally, put the output of the file in a 2D vector  */
-vector <vector <int>> ReadBoardFile (string path)
-{
-    ifstream MyFile ("files/file.board");
-
-    vector < vector <int>> board{};
-
-    if (MyFile)
-    {
-        string line;
-
-        while (getline(MyFile,line))
-        {
-            vector <int> row = ParseLine(line);
-            board.push_back(row);
-        }
-
-    }
-  return board;
-}
+// ParseLine and ReadBoardFile (board.h): read the board file line by line and
+// process each line with istringstream, the result is a 2D vector
 
 // Pass by value function example
 int MultiplyByTwoValue (int i)
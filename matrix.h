@@ -0,0 +1,78 @@
+/*
+- Matrix: rows x cols ints stored row by row in one vector, used by advanced_oop.cpp
+          (operator overloading) and memory_hugepage_arena.cpp (huge page arena).
+
+- Memory resource: the storage is a std::pmr::vector, so the caller decides where the
+                   memory comes from (an arena, a pool ...). without one it uses the
+                   default resource, which is new/delete like std::vector.
+*/
+
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <iostream>
+#include <memory_resource>
+#include <vector>
+
+class Matrix
+{
+       public:
+       Matrix (int rows, int cols, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+              : rows_(rows), cols_(cols), values_(rows * cols, resource)
+       {
+
+       }
+
+                   // overload parenthese operator to access the elements
+       // overload parentheses operator for non const access
+       int& operator() (int row,int col)
+       {
+              return values_[row * cols_ + col];
+       }
+
+       // overload parentheses operator for const access
+       int operator() (int row, int col) const
+       {
+              return values_[row * cols_ + col];
+       }
+       // overload + operator for matrix addition
+       //Prevents modification of the original matrices during addition
+       Matrix operator + (const Matrix& m) const
+       {
+              // the result uses the same memory resource as the left operand
+              Matrix result(rows_, cols_, values_.get_allocator().resource());
+
+             // Adds corresponding elements and stores the result in a new matrix.
+              for (size_t i = 0; i < values_.size(); ++i)
+              {
+                     result.values_[i] = values_[i] + m.values_[i];
+              }
+              return result;
+       }
+
+       // Function to display the matrix
+       void display() const
+       {
+              for (int i = 0; i < rows_; ++i)
+              {
+                     for (int j = 0; j < cols_; ++j)
+                     {
+                            //Uses the overloaded () operator for element access.
+                             std::cout << (*this)(i, j) << " ";
+                     }
+                     std::cout << std::endl;
+              }
+       }
+
+       int Rows() const { return rows_; }
+       int Cols() const { return cols_; }
+
+       private:
+       int rows_;
+       int cols_;
+       // used for storage, allocated from the given memory resource
+       std::pmr::vector<int> values_;
+
+};
+
+#endif
@@ -0,0 +1,518 @@
+/*
+- Allocator benchmark: memory_mng.cpp shows malloc, calloc, realloc, new and the smart pointers,
+                       this program measures them (and the pool/arena allocators) under the same
+                       workloads, so we can choose an allocator per service.
+
+- Allocators:
+              > malloc/free (and realloc for growth)
+              > new/delete
+              > the allocators of the project, shared through their headers:
+                  object pool (object_pool.h): fixed size 64 byte blocks only, thread safe.
+                  huge page arena (hugepage_arena.h): bump allocation, deallocate does nothing.
+                  compacting heap (compacting_heap.h): never compacts during a run (the workloads
+                  keep raw pointers), freed memory is not reused.
+                  persistent heap (persistent_heap.h): on a temporary file, first fit free list.
+                  budget resource (memory_budget.h): new/delete plus the budget accounting.
+              > std::pmr::unsynchronized_pool_resource (single threaded pools)
+              > std::pmr::synchronized_pool_resource (thread safe pools)
+              > std::pmr::monotonic_buffer_resource (arena: deallocate does nothing,
+                all the memory is released at the end)
+
+- Workloads:
+              1- fixed size churn: keep a window of 1024 live 64 byte blocks, free the oldest
+                 and allocate a new one.
+              2- random sizes: same window, sizes 16 .. 1024 bytes, a random victim is replaced.
+              3- producer/consumer: one thread allocates, another thread frees
+                 (only for the thread safe allocators).
+              4- growth via realloc: grow a buffer by 1.5x from 16 bytes up to 1 MB, 20 times,
+                 allocators without realloc allocate + copy + free.
+                 the arena keeps every old buffer, about 3 MB per round (60 MB peak).
+
+- Results: > throughput in operations per microsecond.
+           > p50/p99 latency of a single allocate+free, timed on every 16th operation.
+           > peak RSS: every run is done in a child process (fork), so ru_maxrss of the child
+             is the peak of that allocator alone.
+
+- To build: g++ -std=c++17 -O2 -pthread memory_alloc_benchmark.cpp
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <random>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <new>
+#include <string>
+#include <filesystem>
+#include "object_pool.h"
+#include "hugepage_arena.h"
+#include "compacting_heap.h"
+#include "persistent_heap.h"
+#include "memory_budget.h"
+
+using std::cout;
+
+                            /* Allocators behind one interface */
+class Allocator
+{
+    public:
+    virtual ~Allocator() {}
+    virtual void* Allocate(size_t size) = 0;
+    virtual void Deallocate(void* p, size_t size) = 0;
+
+    // default growth: allocate + copy + free
+    virtual void* Reallocate(void* p, size_t oldSize, size_t newSize)
+    {
+        void* q = Allocate(newSize);
+        memcpy(q, p, oldSize < newSize ? oldSize : newSize);
+        Deallocate(p, oldSize);
+        return q;
+    }
+
+    // biggest block the allocator can give, workloads with bigger blocks skip it
+    virtual size_t MaxSize() const { return (size_t) -1; }
+
+    virtual bool ThreadSafe() const = 0;
+};
+
+class MallocAllocator : public Allocator
+{
+    public:
+    void* Allocate(size_t size) override
+    {
+        void* p = malloc(size);
+        if (p == NULL)
+            throw std::bad_alloc();
+        return p;
+    }
+
+    void Deallocate(void* p, size_t) override { free(p); }
+
+    void* Reallocate(void* p, size_t, size_t newSize) override
+    {
+        void* q = realloc(p, newSize);
+        if (q == NULL)
+        {
+            free(p);        // realloc keeps the old block when it fails
+            throw std::bad_alloc();
+        }
+        return q;
+    }
+    bool ThreadSafe() const override { return true; }
+};
+
+class NewAllocator : public Allocator
+{
+    public:
+    void* Allocate(size_t size) override { return new char[size]; }
+    void Deallocate(void* p, size_t) override { delete[] (char*) p; }
+    bool ThreadSafe() const override { return true; }
+};
+
+class PmrAllocator : public Allocator
+{
+    public:
+    PmrAllocator(std::unique_ptr<std::pmr::memory_resource> resource, bool threadSafe)
+        : _resource(std::move(resource)), _threadSafe(threadSafe) {}
+
+    void* Allocate(size_t size) override { return _resource->allocate(size, 16); }
+    void Deallocate(void* p, size_t size) override { _resource->deallocate(p, size, 16); }
+    bool ThreadSafe() const override { return _threadSafe; }
+
+    private:
+    std::unique_ptr<std::pmr::memory_resource> _resource;
+    bool _threadSafe;
+};
+
+// ObjectPool (memory_object_pool.cpp) hands out objects of one type, here 64 byte blocks
+class ObjectPoolAllocator : public Allocator
+{
+    public:
+    static const size_t BlockSize = 64;
+
+    void* Allocate(size_t size) override
+    {
+        if (size > BlockSize)
+            throw std::bad_alloc();
+        return _pool.Acquire().release();
+    }
+
+    // the handle made by Adopt gives the slot back when it goes out of scope
+    void Deallocate(void* p, size_t) override { _pool.Adopt((Block*) p); }
+
+    size_t MaxSize() const override { return BlockSize; }
+    bool ThreadSafe() const override { return true; }
+
+    private:
+    struct alignas(16) Block { unsigned char bytes[BlockSize]; };
+
+    ObjectPool<Block> _pool;
+};
+
+/* CompactingHeap (memory_compacting_heap.cpp) moves blocks when it compacts, but the workloads keep raw
+   pointers, so the heap is made big enough to never compact during a run. freed blocks are reclaimed
+   only by compaction, so the peak RSS shows the cost of not compacting */
+class CompactingAllocator : public Allocator
+{
+    public:
+    CompactingAllocator() : _heap(512 * 1024 * 1024) {}
+
+    void* Allocate(size_t size) override
+    {
+        if (!_heap.Fits(size))
+            throw std::bad_alloc();
+        return _heap.Get(_heap.Allocate(size));
+    }
+
+    void Deallocate(void* p, size_t) override { _heap.Free(_heap.HandleOf(p)); }
+    bool ThreadSafe() const override { return false; }
+
+    private:
+    CompactingHeap _heap;
+};
+
+// PersistentHeap (memory_persistent_heap.cpp) on a temporary file, removed as soon as it is mapped
+class PersistentAllocator : public Allocator
+{
+    public:
+    PersistentAllocator()
+    {
+        std::string path = (std::filesystem::temp_directory_path() / "alloc_benchmarkXXXXXX").string();
+        int fd = mkstemp(&path[0]);
+        if (fd < 0)
+            throw std::bad_alloc();
+        close(fd);
+
+        bool created = false, wasClean = false;
+        bool opened = _heap.Open(path.c_str(), 256 * 1024 * 1024, created, wasClean);
+        unlink(path.c_str());
+        if (!opened)
+            throw std::bad_alloc();
+    }
+
+    void* Allocate(size_t size) override { return _heap.allocate(size, 16); }
+    void Deallocate(void* p, size_t size) override { _heap.deallocate(p, size, 16); }
+    bool ThreadSafe() const override { return false; }
+
+    private:
+    PersistentHeap _heap;
+};
+
+// BudgetResource (memory_budgets.cpp) over new/delete, limits high enough to never be hit:
+// measures the cost of the accounting
+class BudgetAllocator : public Allocator
+{
+    public:
+    BudgetAllocator()
+        : _budget("benchmark", (size_t) 1 << 40, (size_t) 1 << 41),
+          _resource(_budget, std::pmr::new_delete_resource()) {}
+
+    void* Allocate(size_t size) override { return _resource.allocate(size, 16); }
+    void Deallocate(void* p, size_t size) override { _resource.deallocate(p, size, 16); }
+    bool ThreadSafe() const override { return true; }
+
+    private:
+    MemoryBudget _budget;
+    BudgetResource _resource;
+};
+
+struct AllocatorFactory
+{
+    const char* name;
+    std::function<std::unique_ptr<Allocator>()> make;
+};
+
+std::vector<AllocatorFactory> AllAllocators()
+{
+    return {
+        {"malloc/free", [] { return std::unique_ptr<Allocator>(new MallocAllocator()); }},
+        {"new/delete", [] { return std::unique_ptr<Allocator>(new NewAllocator()); }},
+        {"object pool", [] { return std::unique_ptr<Allocator>(new ObjectPoolAllocator()); }},
+        {"huge page arena", [] { return std::unique_ptr<Allocator>(new PmrAllocator(
+            std::unique_ptr<std::pmr::memory_resource>(new HugePageArena(256 * 1024 * 1024)), false)); }},
+        {"compacting heap", [] { return std::unique_ptr<Allocator>(new CompactingAllocator()); }},
+        {"persistent heap", [] { return std::unique_ptr<Allocator>(new PersistentAllocator()); }},
+        {"budget resource", [] { return std::unique_ptr<Allocator>(new BudgetAllocator()); }},
+        {"pmr unsync pool", [] { return std::unique_ptr<Allocator>(new PmrAllocator(
+            std::unique_ptr<std::pmr::memory_resource>(new std::pmr::unsynchronized_pool_resource()), false)); }},
+        {"pmr sync pool", [] { return std::unique_ptr<Allocator>(new PmrAllocator(
+            std::unique_ptr<std::pmr::memory_resource>(new std::pmr::synchronized_pool_resource()), true)); }},
+        {"pmr arena", [] { return std::unique_ptr<Allocator>(new PmrAllocator(
+            std::unique_ptr<std::pmr::memory_resource>(new std::pmr::monotonic_buffer_resource()), false)); }},
+    };
+}
+
+                            /* Measurements */
+enum Status { Ok, NotThreadSafe, TooBig, Failed };
+
+struct Result
+{
+    double opsPerUs;
+    double p50Ns;
+    double p99Ns;
+    long peakRssKb;
+    Status status;
+};
+
+class Timer
+{
+    public:
+    Timer() : _start(std::chrono::steady_clock::now()) {}
+
+    double Ns() const
+    {
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - _start).count();
+    }
+
+    private:
+    std::chrono::steady_clock::time_point _start;
+};
+
+double Percentile(std::vector<double>& samples, double q)
+{
+    if (samples.empty())
+        return 0;
+    size_t k = (size_t) (q * (samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+    return samples[k];
+}
+
+const size_t Window = 1024;
+const long SampleEvery = 16;
+
+// keep a window of live blocks, replace one block per operation
+Result WindowChurn(Allocator& a, long ops, bool randomSizes)
+{
+    if (a.MaxSize() < (randomSizes ? 1024 : 64))
+        return Result{0, 0, 0, 0, TooBig};
+
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<size_t> size(16, 1024);
+    std::uniform_int_distribution<size_t> victim(0, Window - 1);
+
+    std::vector<void*> live(Window);
+    std::vector<size_t> sizes(Window);
+    for (size_t i = 0; i < Window; ++i)
+    {
+        sizes[i] = randomSizes ? size(rng) : 64;
+        live[i] = a.Allocate(sizes[i]);
+    }
+
+    std::vector<double> latencies;
+    latencies.reserve(ops / SampleEvery + 1);
+    Timer total;
+    for (long i = 0; i < ops; ++i)
+    {
+        size_t k = randomSizes ? victim(rng) : (size_t) i % Window;
+        size_t s = randomSizes ? size(rng) : 64;
+        if (i % SampleEvery == 0)
+        {
+            Timer one;
+            a.Deallocate(live[k], sizes[k]);
+            live[k] = a.Allocate(s);
+            latencies.push_back(one.Ns());
+        }
+        else
+        {
+            a.Deallocate(live[k], sizes[k]);
+            live[k] = a.Allocate(s);
+        }
+        sizes[k] = s;
+        memset(live[k], (int) i, 8);
+    }
+    double ns = total.Ns();
+
+    for (size_t i = 0; i < Window; ++i)
+        a.Deallocate(live[i], sizes[i]);
+
+    return Result{ops / (ns / 1000), Percentile(latencies, 0.5), Percentile(latencies, 0.99), 0, Ok};
+}
+
+// one thread allocates, the other frees, blocks are passed in batches of 64
+Result ProducerConsumer(Allocator& a, long ops)
+{
+    if (!a.ThreadSafe())
+        return Result{0, 0, 0, 0, NotThreadSafe};
+    if (a.MaxSize() < 64)
+        return Result{0, 0, 0, 0, TooBig};
+
+    std::mutex m;
+    std::condition_variable cv;
+    std::queue<std::vector<void*>> batches;
+    bool done = false;
+    std::vector<double> latencies;
+
+    Timer total;
+    std::thread consumer([&] {
+        for (;;)
+        {
+            std::vector<void*> batch;
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [&] { return done || !batches.empty(); });
+                if (batches.empty())
+                    return;
+                batch.swap(batches.front());
+                batches.pop();
+            }
+            for (void* p : batch)
+                a.Deallocate(p, 64);
+        }
+    });
+
+    std::vector<void*> batch;
+    for (long i = 0; i < ops; ++i)
+    {
+        if (i % SampleEvery == 0)
+        {
+            Timer one;
+            batch.push_back(a.Allocate(64));
+            latencies.push_back(one.Ns());
+        }
+        else
+            batch.push_back(a.Allocate(64));
+
+        if (batch.size() == 64)
+        {
+            std::lock_guard<std::mutex> lock(m);
+            batches.push(std::move(batch));
+            batch.clear();
+            cv.notify_one();
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(m);
+        batches.push(std::move(batch));
+        done = true;
+    }
+    cv.notify_one();
+    consumer.join();
+    double ns = total.Ns();
+
+    return Result{ops / (ns / 1000), Percentile(latencies, 0.5), Percentile(latencies, 0.99), 0, Ok};
+}
+
+// grow a buffer from 16 bytes to 1 MB by 1.5x, many times
+Result Growth(Allocator& a, long rounds)
+{
+    if (a.MaxSize() < 2 * 1024 * 1024)
+        return Result{0, 0, 0, 0, TooBig};
+
+    std::vector<double> latencies;
+    long ops = 0;
+    Timer total;
+    for (long r = 0; r < rounds; ++r)
+    {
+        size_t size = 16;
+        void* p = a.Allocate(size);
+        memset(p, 1, size);
+        while (size < 1024 * 1024)
+        {
+            size_t next = size + size / 2;
+            Timer one;
+            p = a.Reallocate(p, size, next);
+            latencies.push_back(one.Ns());
+            ((char*) p)[next - 1] = 1;
+            size = next;
+            ++ops;
+        }
+        a.Deallocate(p, size);
+    }
+    double ns = total.Ns();
+
+    return Result{ops / (ns / 1000), Percentile(latencies, 0.5), Percentile(latencies, 0.99), 0, Ok};
+}
+
+// run one workload in a child process so that its peak RSS is not mixed with the others
+Result RunIsolated(const AllocatorFactory& factory, std::function<Result(Allocator&)> workload)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        return Result{0, 0, 0, 0, Failed};
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(fds[0]);
+        Result r{0, 0, 0, 0, Failed};
+        try
+        {
+            std::unique_ptr<Allocator> a = factory.make();
+            r = workload(*a);
+            struct rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            r.peakRssKb = usage.ru_maxrss;
+        }
+        catch (const std::bad_alloc&)
+        {
+            r.status = Failed;      // out of memory (or the allocator could not be created)
+        }
+        ssize_t written = write(fds[1], &r, sizeof(r));
+        _exit(written == (ssize_t) sizeof(r) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    Result r{0, 0, 0, 0, Failed};
+    ssize_t got = read(fds[0], &r, sizeof(r));
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    if (got != (ssize_t) sizeof(r))
+        r.status = Failed;
+    return r;
+}
+
+void Print(const char* allocator, const Result& r)
+{
+    cout << "  " << std::left << std::setw(18) << allocator << std::right;
+    if (r.status != Ok)
+    {
+        cout << (r.status == NotThreadSafe ? "  (not thread safe, skipped)"
+                 : r.status == TooBig ? "  (blocks too big for it, skipped)" : "  (run failed)") << std::endl;
+        return;
+    }
+    cout << std::fixed << std::setprecision(2)
+         << std::setw(10) << r.opsPerUs << " ops/us"
+         << std::setw(10) << r.p50Ns << " ns p50"
+         << std::setw(10) << r.p99Ns << " ns p99"
+         << std::setw(10) << r.peakRssKb / 1024 << " MB peak RSS" << std::endl;
+}
+
+int main()
+{
+    struct Workload
+    {
+        const char* name;
+        std::function<Result(Allocator&)> run;
+    };
+
+    std::vector<Workload> workloads = {
+        {"fixed size churn (64 B)", [](Allocator& a) { return WindowChurn(a, 2000000, false); }},
+        {"random sizes (16 .. 1024 B)", [](Allocator& a) { return WindowChurn(a, 200000, true); }},
+        {"producer/consumer cross thread free", [](Allocator& a) { return ProducerConsumer(a, 1000000); }},
+        {"growth via realloc (16 B .. 1 MB)", [](Allocator& a) { return Growth(a, 20); }},
+    };
+
+    std::vector<AllocatorFactory> allocators = AllAllocators();
+    for (Workload& w : workloads)
+    {
+        cout << w.name << std::endl;
+        for (AllocatorFactory& f : allocators)
+            Print(f.name, RunIsolated(f, w.run));
+    }
+
+    return 0;
+}
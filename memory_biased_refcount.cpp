@@ -0,0 +1,384 @@
+/*
+- Reference counter contention: in memory_mng.cpp, shared2 = shared1 increases the
+                                reference counter of the control block. if many threads copy
+                                the same shared pointer, all of them write to the same atomic
+                                counter, so the cache line holding it keeps moving between the cores
+                                (cache line ping-pong) and the copies become slow.
+
+- Biased reference counting: most objects are only copied and released by the thread which
+                             created them (the owner thread), so the counter is split into two:
+                             > biased counter: a plain (non-atomic) counter used only by the owner thread.
+                             > shared counter: an atomic counter used by all the other threads.
+                             the object is alive while biased + shared > 0.
+
+- Merging: the two counters are merged when
+           > the biased counter reaches zero (the owner dropped all of its references), or
+           > the shared counter becomes negative, this happens when a reference created by the owner
+             is released by another thread. that thread can't touch the biased counter, so it puts
+             the object in the owner's queue and the owner merges it in ProcessPendingMerges().
+             when the owner thread exits, its queue is processed and closed, after that
+             the other threads merge the objects by themselves.
+           after merging, every thread (including the owner) uses the shared counter only.
+
+- Shared counter layout: count * 4 | QUEUED (2) | MERGED (1)
+                         the object is deleted by the operation which leaves the state at
+                         count 0, MERGED and not QUEUED.
+                         QUEUED is cleared only when the object is taken out of the owner's queue,
+                         so the object can't be deleted while the queue still points to it.
+
+- NB: the other threads still share one atomic counter, so biased counting helps when most of
+      the copies are done by the owner thread. the benchmark below shows the owner thread keeps
+      its speed while the other threads are hammering the same object.
+
+- To build: g++ -std=c++17 -O2 -pthread memory_biased_refcount.cpp
+*/
+
+#include <iostream>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <new>
+#include <utility>
+
+using std::cout;
+
+struct BiasedHeader;
+
+/* each thread owns one queue of objects waiting to be merged
+   the objects keep the queue alive (shared_ptr), so its address can be used as the owner identity */
+struct OwnerQueue
+{
+    std::mutex m;
+    std::vector<BiasedHeader*> pending;
+    bool closed = false;
+};
+
+struct BiasedHeader
+{
+    static const long MERGED = 1;
+    static const long QUEUED = 2;
+    static const long ONE = 4;
+
+    std::shared_ptr<OwnerQueue> owner;
+    long biased;                 // owner thread only
+    bool merged;                 // owner thread only (or anyone after the owner exited)
+    std::atomic<long> shared;
+    void (*destroy)(BiasedHeader*);
+
+    static long Count(long v) { return v >> 2; }
+};
+
+void MergeBiased(BiasedHeader* h, bool dequeued);
+
+/* thread_local holder: processes and closes the queue when the thread exits */
+struct ThreadOwner
+{
+    std::shared_ptr<OwnerQueue> queue = std::make_shared<OwnerQueue>();
+
+    ~ThreadOwner()
+    {
+        std::vector<BiasedHeader*> pending;
+        {
+            std::lock_guard<std::mutex> lock(queue->m);
+            queue->closed = true;
+            pending.swap(queue->pending);
+        }
+        for (BiasedHeader* h : pending)
+            MergeBiased(h, true);
+    }
+};
+
+ThreadOwner& ThisThreadOwner()
+{
+    thread_local ThreadOwner owner;
+    return owner;
+}
+
+// fold the biased counter into the shared one, called by the owner (or by anyone after the owner exited)
+// dequeued: h was just taken out of the owner's queue, otherwise QUEUED stays set and the queue frees h
+void MergeBiased(BiasedHeader* h, bool dequeued)
+{
+    long add = h->merged ? 0 : h->biased * BiasedHeader::ONE;
+    h->biased = 0;
+    h->merged = true;
+
+    long old = h->shared.load(std::memory_order_relaxed);
+    long next;
+    do
+    {
+        next = (old + add) | BiasedHeader::MERGED;
+        if (dequeued)
+            next &= ~BiasedHeader::QUEUED;
+    } while (!h->shared.compare_exchange_weak(old, next, std::memory_order_acq_rel));
+
+    if (next == BiasedHeader::MERGED)
+        h->destroy(h);
+}
+
+// owner thread calls this at its safe points to merge objects released by other threads
+void ProcessPendingMerges()
+{
+    OwnerQueue& q = *ThisThreadOwner().queue;
+    std::vector<BiasedHeader*> pending;
+    {
+        std::lock_guard<std::mutex> lock(q.m);
+        pending.swap(q.pending);
+    }
+    for (BiasedHeader* h : pending)
+        MergeBiased(h, true);
+}
+
+template <typename T>
+struct BiasedBlock : BiasedHeader
+{
+    alignas(T) unsigned char storage[sizeof(T)];
+
+    T* object() { return reinterpret_cast<T*>(storage); }
+
+    static void Destroy(BiasedHeader* h)
+    {
+        BiasedBlock* b = static_cast<BiasedBlock*>(h);
+        b->object()->~T();
+        delete b;
+    }
+};
+
+template <typename T>
+class BiasedPtr
+{
+    typedef BiasedBlock<T> Block;
+    Block* _b;
+
+    explicit BiasedPtr(Block* b) : _b(b) {}
+
+    bool IsOwnerFastPath() const
+    {
+        return _b->owner.get() == ThisThreadOwner().queue.get() && !_b->merged;
+    }
+
+    void Acquire()
+    {
+        if (IsOwnerFastPath())
+            ++_b->biased;
+        else
+            _b->shared.fetch_add(BiasedHeader::ONE, std::memory_order_relaxed);
+    }
+
+    void Release()
+    {
+        if (_b == nullptr)
+            return;
+
+        if (IsOwnerFastPath())
+        {
+            if (--_b->biased == 0)
+                MergeBiased(_b, false);
+        }
+        else
+        {
+            long v = _b->shared.fetch_sub(BiasedHeader::ONE, std::memory_order_acq_rel) - BiasedHeader::ONE;
+
+            if (v == BiasedHeader::MERGED)
+                _b->destroy(_b);
+            else if (!(v & BiasedHeader::MERGED) && BiasedHeader::Count(v) < 0 && !(v & BiasedHeader::QUEUED))
+                Enqueue(v);
+        }
+        _b = nullptr;
+    }
+
+    // shared counter went negative: ask the owner to merge this object
+    void Enqueue(long v)
+    {
+        while (!(v & (BiasedHeader::QUEUED | BiasedHeader::MERGED)))
+        {
+            if (_b->shared.compare_exchange_weak(v, v | BiasedHeader::QUEUED, std::memory_order_acq_rel))
+            {
+                OwnerQueue& q = *_b->owner;
+                std::unique_lock<std::mutex> lock(q.m);
+                if (!q.closed)
+                {
+                    q.pending.push_back(_b);
+                    return;
+                }
+                // owner thread is gone, its last writes are visible through the queue mutex
+                lock.unlock();
+                MergeBiased(_b, true);
+                return;
+            }
+        }
+    }
+
+    template <typename U, typename... Args>
+    friend BiasedPtr<U> make_biased(Args&&... args);
+
+    public:
+    BiasedPtr() : _b(nullptr) {}
+
+    BiasedPtr(const BiasedPtr& other) : _b(other._b)
+    {
+        if (_b != nullptr)
+            Acquire();
+    }
+
+    BiasedPtr(BiasedPtr&& other) noexcept : _b(other._b)
+    {
+        other._b = nullptr;
+    }
+
+    BiasedPtr& operator= (BiasedPtr other) noexcept
+    {
+        std::swap(_b, other._b);
+        return *this;
+    }
+
+    ~BiasedPtr()
+    {
+        Release();
+    }
+
+    void reset() { Release(); }
+
+    T* get() const { return _b ? _b->object() : nullptr; }
+    T& operator* () const { return *_b->object(); }
+    T* operator-> () const { return _b->object(); }
+    explicit operator bool () const { return _b != nullptr; }
+};
+
+template <typename T, typename... Args>
+BiasedPtr<T> make_biased(Args&&... args)
+{
+    typedef BiasedBlock<T> Block;
+
+    Block* b = new Block();
+    b->owner = ThisThreadOwner().queue;
+    b->biased = 1;
+    b->merged = false;
+    b->shared.store(0, std::memory_order_relaxed);
+    b->destroy = &Block::Destroy;
+    try
+    {
+        new (b->storage) T(std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+        delete b;
+        throw;
+    }
+    return BiasedPtr<T>(b);
+}
+
+                            /* Queued then merged by the owner */
+/* the object is queued by another thread, then the owner merges it because its biased counter
+   reached zero, then the last reference is released. the queue entry must still be valid when
+   the owner processes it, and the object must be destroyed exactly once (run it with -fsanitize=address) */
+struct Tracked
+{
+    static int destroyed;
+    ~Tracked() { ++destroyed; }
+};
+int Tracked::destroyed = 0;
+
+bool TestQueuedThenOwnerMerge()
+{
+    Tracked::destroyed = 0;
+    BiasedPtr<Tracked> p = make_biased<Tracked>();
+    BiasedPtr<Tracked> c1 = p;              // biased 2
+    BiasedPtr<Tracked> d1, d2;
+
+    std::thread other([&] {
+        c1.reset();                         // shared -1: queued for the owner
+        d1 = p;                             // shared back to +1
+        d2 = p;
+    });
+    other.join();
+
+    p.reset();
+    d1.reset();                             // biased 0: the owner merges while the object is queued
+
+    std::thread last([&] { d2.reset(); });  // count 0, but the queue still points to it
+    last.join();
+    bool aliveWhileQueued = Tracked::destroyed == 0;
+
+    ProcessPendingMerges();                 // only now the object can go
+    return aliveWhileQueued && Tracked::destroyed == 1;
+}
+
+                            /* Scaling benchmark */
+/* the owner thread copies the pointer in a loop while (threads - 1) other threads copy the
+   same object. reports the owner copies per microsecond and the total copies per microsecond */
+template <typename Ptr>
+void RunScaling(const char* name, const Ptr& source, int threads, long copiesPerThread)
+{
+    std::atomic<bool> go(false);
+    std::atomic<long> sink(0);
+
+    auto work = [&] {
+        while (!go.load(std::memory_order_acquire))
+            std::this_thread::yield();
+        long local = 0;
+        for (long i = 0; i < copiesPerThread; ++i)
+        {
+            Ptr copy = source;
+            local += *copy;
+        }
+        sink += local;
+    };
+
+    std::vector<std::thread> others;
+    for (int t = 1; t < threads; ++t)
+        others.emplace_back(work);
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    go.store(true, std::memory_order_release);
+    work();
+    auto ownerStop = std::chrono::high_resolution_clock::now();
+    for (std::thread& t : others)
+        t.join();
+    auto stopTime = std::chrono::high_resolution_clock::now();
+
+    double ownerUs = std::chrono::duration<double, std::micro>(ownerStop - startTime).count();
+    double totalUs = std::chrono::duration<double, std::micro>(stopTime - startTime).count();
+
+    cout << name << " threads " << threads
+         << "  owner copies/us: " << copiesPerThread / ownerUs
+         << "  total copies/us: " << copiesPerThread * threads / totalUs << std::endl;
+}
+
+int main()
+{
+                        /* shared1/shared2 example with a biased pointer */
+    {
+        BiasedPtr<int> biased1 = make_biased<int>(7);
+        {
+            BiasedPtr<int> biased2 = biased1;   // owner thread: plain increment
+            cout << " biased2 = " << *biased2 << std::endl;
+        }
+
+        // a copy released by another thread makes the shared counter negative
+        BiasedPtr<int> forOther = biased1;
+        std::thread other([p = std::move(forOther)]() mutable { p.reset(); });
+        other.join();
+
+        ProcessPendingMerges();
+        cout << " merged after other thread release, value = " << *biased1 << std::endl;
+    }
+
+    cout << " queued then merged by the owner: " << (TestQueuedThenOwnerMerge() ? "ok" : "FAILED") << std::endl;
+
+                        /* scaling compared to shared_ptr */
+    const long N = 2000000;
+    std::shared_ptr<int> shared = std::make_shared<int>(1);
+    BiasedPtr<int> biased = make_biased<int>(1);
+
+    for (int threads = 1; threads <= 64; threads *= 2)
+    {
+        RunScaling("shared_ptr", shared, threads, N);
+        RunScaling("BiasedPtr ", biased, threads, N);
+    }
+
+    ProcessPendingMerges();
+    return 0;
+}
@@ -0,0 +1,162 @@
+/*
+- MemoryBudget and BudgetResource: the per subsystem budgets of memory_budgets.cpp (soft limit with
+                                   pressure callbacks, hard limit), BudgetResource charges the
+                                   allocations of any std::pmr::memory_resource to a budget.
+                                   also used by memory_alloc_benchmark.cpp.
+*/
+
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <memory_resource>
+#include <string>
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <new>
+
+class MemoryBudget
+{
+    public:
+    typedef std::function<void(MemoryBudget&)> PressureCallback;
+
+    MemoryBudget(const std::string& name, size_t softLimit, size_t hardLimit)
+        : _name(name), _soft(softLimit), _hard(hardLimit), _used(0), _peak(0), _failures(0),
+          _aboveSoft(false), _crossings(0), _inPressure(false), _callbacks(std::make_shared<const Callbacks>()) {}
+
+    // charges bytes to the budget, returns false (and charges nothing) above the hard limit
+    bool Charge(size_t bytes)
+    {
+        size_t used = _used.load(std::memory_order_relaxed);
+        size_t now;
+        do
+        {
+            if (bytes > _hard - used)
+            {
+                _failures.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            now = used + bytes;
+        } while (!_used.compare_exchange_weak(used, now, std::memory_order_relaxed));
+
+        size_t peak = _peak.load(std::memory_order_relaxed);
+        while (now > peak && !_peak.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {}
+
+        // only the allocation which crosses the soft limit calls the callbacks
+        if (now > _soft && !_aboveSoft.load(std::memory_order_relaxed)
+            && !_aboveSoft.exchange(true, std::memory_order_relaxed))
+        {
+            _crossings.fetch_add(1);
+            Pressure();
+        }
+        return true;
+    }
+
+    void Release(size_t bytes)
+    {
+        size_t now = _used.fetch_sub(bytes, std::memory_order_relaxed) - bytes;
+        if (now <= _soft && _aboveSoft.load(std::memory_order_relaxed))
+            _aboveSoft.store(false, std::memory_order_relaxed);
+    }
+
+    // registering is rare: the list is copied here, never on the allocation path
+    void OnPressure(PressureCallback callback)
+    {
+        std::lock_guard<std::mutex> lock(_callbacksMutex);
+        std::shared_ptr<Callbacks> next = std::make_shared<Callbacks>(*std::atomic_load(&_callbacks));
+        next->push_back(std::move(callback));
+        std::atomic_store(&_callbacks, std::shared_ptr<const Callbacks>(std::move(next)));
+    }
+
+    const std::string& Name() const { return _name; }
+    size_t Used() const { return _used.load(std::memory_order_relaxed); }
+    size_t Peak() const { return _peak.load(std::memory_order_relaxed); }
+    size_t SoftLimit() const { return _soft; }
+    size_t HardLimit() const { return _hard; }
+    long Failures() const { return _failures.load(std::memory_order_relaxed); }
+
+    private:
+    typedef std::vector<PressureCallback> Callbacks;
+
+    // only one thread runs the callbacks, allocations made by the callbacks don't call them again.
+    // a crossing which comes while they run is not lost: the running thread sees the changed crossing
+    // count when it finishes and runs them once more if the usage is still above the soft limit
+    // (seq_cst: the counter increment and the failed compare_exchange of the other thread can't
+    // both be missed by the store and the load here)
+    void Pressure()
+    {
+        bool expected = false;
+        if (!_inPressure.compare_exchange_strong(expected, true))
+            return;
+
+        for (;;)
+        {
+            unsigned long served = _crossings.load();
+            std::shared_ptr<const Callbacks> callbacks = std::atomic_load(&_callbacks);
+            for (const PressureCallback& callback : *callbacks)
+                callback(*this);
+
+            _inPressure.store(false);
+            if (_crossings.load() == served || Used() <= _soft)
+                return;
+            expected = false;
+            if (!_inPressure.compare_exchange_strong(expected, true))
+                return;     // another thread runs them now
+        }
+    }
+
+    std::string _name;
+    size_t _soft;
+    size_t _hard;
+    std::atomic<size_t> _used;
+    std::atomic<size_t> _peak;
+    std::atomic<long> _failures;
+    std::atomic<bool> _aboveSoft;
+    std::atomic<unsigned long> _crossings;          // soft limit crossings so far
+    std::atomic<bool> _inPressure;
+    std::mutex _callbacksMutex;                     // serializes OnPressure only
+    std::shared_ptr<const Callbacks> _callbacks;
+};
+
+class BudgetResource : public std::pmr::memory_resource
+{
+    public:
+    BudgetResource(MemoryBudget& budget, std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+        : _budget(budget), _upstream(upstream) {}
+
+    MemoryBudget& Budget() { return _budget; }
+
+    private:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        if (!_budget.Charge(bytes))
+            throw std::bad_alloc();
+        try
+        {
+            return _upstream->allocate(bytes, alignment);
+        }
+        catch (...)
+        {
+            _budget.Release(bytes);
+            throw;
+        }
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override
+    {
+        _upstream->deallocate(p, bytes, alignment);
+        _budget.Release(bytes);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    MemoryBudget& _budget;
+    std::pmr::memory_resource* _upstream;
+};
+
+#endif
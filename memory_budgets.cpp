@@ -0,0 +1,137 @@
+/*
+- Problem: several components (lists, boards, matrices, observers ...) run in one process and share
+           one heap. when the process uses too much memory we can't tell which component did it.
+
+- Memory budget: every subsystem gets a named budget with two limits
+                 > soft limit: when crossed, the pressure callbacks of the budget are called, so
+                   caches can shrink (drop entries they can build again). they are called once per
+                   crossing, again only after the usage went back below the soft limit.
+                   NB: the callback runs inside the allocation, so it must not change the container
+                   which is allocating right now, it should only ask it to shrink (set a flag)
+                   or shrink other containers.
+                 > hard limit: an allocation which would cross it fails with std::bad_alloc,
+                   the subsystem can't take memory from the others.
+                 the budget also keeps the current and the peak bytes for reports.
+
+- Lock-free accounting: the used bytes are a std::atomic counter, an allocation adds its bytes with
+                        a compare_exchange loop which only succeeds if the result stays within the
+                        hard limit, so two threads overshooting together can't make each other fail.
+                        the callbacks are kept in an immutable list (shared_ptr) which is replaced
+                        by OnPressure, so calling them copies nothing and never waits for OnPressure.
+                        (std::atomic_load of a shared_ptr is not lock-free in libstdc++, it takes a
+                        short lock from a global pool, only around the pointer copy.)
+                        a crossing which happens while another thread runs the callbacks is
+                        handled by that thread when it finishes, if the usage is still above the
+                        soft limit.
+
+- BudgetResource: a std::pmr::memory_resource which wraps another resource (upstream) and charges
+                  every allocate/deallocate to a budget. any std::pmr container or resource of the
+                  project (pool, arena ...) can be wrapped:
+                  std::pmr::list<int> l (&listsResource);
+
+- To build: g++ -std=c++17 -O2 memory_budgets.cpp
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <memory_resource>
+#include <list>
+#include <vector>
+#include <deque>
+#include <string>
+#include <mutex>
+#include <memory>
+#include <new>
+#include "memory_budget.h"
+
+using std::cout;
+
+// all the budgets of the process, for the report
+class MemoryBudgets
+{
+    public:
+    MemoryBudget& Add(const std::string& name, size_t softLimit, size_t hardLimit)
+    {
+        std::lock_guard<std::mutex> lock(_m);
+        _budgets.emplace_back(new MemoryBudget(name, softLimit, hardLimit));
+        return *_budgets.back();
+    }
+
+    void Report() const
+    {
+        std::lock_guard<std::mutex> lock(_m);
+        cout << std::left << std::setw(12) << "budget" << std::right
+             << std::setw(12) << "used KB" << std::setw(12) << "peak KB"
+             << std::setw(12) << "soft KB" << std::setw(12) << "hard KB" << std::setw(10) << "failed" << std::endl;
+        for (const std::unique_ptr<MemoryBudget>& b : _budgets)
+            cout << std::left << std::setw(12) << b->Name() << std::right
+                 << std::setw(12) << b->Used() / 1024 << std::setw(12) << b->Peak() / 1024
+                 << std::setw(12) << b->SoftLimit() / 1024 << std::setw(12) << b->HardLimit() / 1024
+                 << std::setw(10) << b->Failures() << std::endl;
+    }
+
+    private:
+    mutable std::mutex _m;
+    std::vector<std::unique_ptr<MemoryBudget>> _budgets;
+};
+
+int main()
+{
+    MemoryBudgets budgets;
+    MemoryBudget& lists = budgets.Add("lists", 4 << 20, 8 << 20);
+    MemoryBudget& boards = budgets.Add("boards", 1 << 20, 2 << 20);
+    MemoryBudget& matrices = budgets.Add("matrices", 16 << 20, 32 << 20);
+    MemoryBudget& observers = budgets.Add("observers", 256 << 10, 1 << 20);
+
+    // a pool resource can be wrapped too: the budget sees the pool's requests to its upstream
+    BudgetResource listsResource(lists);
+    std::pmr::unsynchronized_pool_resource listsPool(&listsResource);
+    BudgetResource boardsResource(boards);
+    BudgetResource matricesResource(matrices);
+    BudgetResource observersResource(observers);
+
+                        /* lists */
+    std::pmr::list<int> list(&listsPool);
+    for (int i = 0; i < 100000; ++i)
+        list.push_back(i);
+
+                        /* matrices */
+    std::pmr::vector<int> matrix(1024 * 1024, 0, &matricesResource);
+
+                        /* observer cache which shrinks under pressure */
+    std::pmr::deque<std::pmr::string> observerCache(&observersResource);
+    bool shrinkWanted = false;
+    int shrinks = 0;
+    observers.OnPressure([&](MemoryBudget&) { shrinkWanted = true; });
+
+    for (int i = 0; i < 20000; ++i)
+    {
+        observerCache.emplace_back("observer notification number " + std::to_string(i));
+        if (shrinkWanted)
+        {
+            // drop the older half of the cache
+            size_t drop = observerCache.size() / 2;
+            observerCache.erase(observerCache.begin(), observerCache.begin() + drop);
+            observerCache.shrink_to_fit();
+            shrinkWanted = false;
+            ++shrinks;
+        }
+    }
+
+                        /* boards: hard limit */
+    std::vector<std::pmr::vector<char>> loadedBoards;
+    try
+    {
+        for (int i = 0; i < 100; ++i)
+            loadedBoards.emplace_back(64 * 1024, '.', &boardsResource);
+    }
+    catch (const std::bad_alloc&)
+    {
+        cout << "boards hit the hard limit after " << loadedBoards.size() << " boards" << std::endl;
+    }
+
+    cout << "observer cache shrank " << shrinks << " times, " << observerCache.size() << " entries left" << std::endl;
+    budgets.Report();
+
+    return 0;
+}
@@ -0,0 +1,103 @@
+/*
+- Fragmentation: after many malloc/realloc/calloc/free calls (memory_mng.cpp), the heap has free
+                 holes between the blocks which are still used. the holes are too small or in the
+                 wrong place to be reused, and the pages around them can't be given back to the OS,
+                 so the process memory (RSS) keeps growing.
+
+- Why malloc can't fix it: the program holds raw pointers to the blocks, so malloc is never
+                           allowed to move a block.
+
+- Handle based heap: the program holds a 32 bit handle instead of a pointer.
+                     > the heap keeps a handle table: handle -> current offset of the block.
+                     > Get (handle) returns the current address, it is valid only until the next
+                       compaction step, so it must be asked again (like iterators after vector growth).
+                     > a handle = 24 bit index in the table + 8 bit generation, so an old handle
+                       to a freed and reused entry is detected.
+
+- Compaction: live blocks are moved down (memmove) to close the holes and the handle table is
+              updated. it is incremental: CompactStep (bytes) moves at most that many bytes, so a
+              long running process can spread the work.
+              when a pass finishes, the whole pages above the new end are given back to the OS
+              with madvise (MADV_DONTNEED).
+
+- Fragmentation report: fragmentation = 1 - live bytes / used span, and the resident bytes
+                        of the region (mincore), before and after compaction.
+
+- To build: g++ -std=c++17 -O2 memory_compacting_heap.cpp
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <vector>
+#include <random>
+#include "compacting_heap.h"
+
+using std::cout;
+
+void PrintStats(const char* when, const CompactingHeap::Stats& s)
+{
+    cout << when << ": used " << s.usedSpan / 1024 << " KB, live " << s.liveBytes / 1024
+         << " KB, resident " << s.residentBytes / 1024 << " KB, fragmentation "
+         << s.fragmentation * 100 << " %" << std::endl;
+}
+
+struct myStruct
+{
+    int i;
+    double d;
+    char a[5];
+};
+
+int main()
+{
+    CompactingHeap heap(256 * 1024 * 1024);
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> size(16, 4096);
+
+                        /* malloc / calloc / realloc like the examples in memory_mng.cpp */
+    CompactingHeap::Handle p2 = heap.Allocate(2 * sizeof(int));
+    ((int*) heap.Get(p2))[0] = 1;
+    ((int*) heap.Get(p2))[1] = 2;
+    heap.Reallocate(p2, 4 * sizeof(int));
+    ((int*) heap.Get(p2))[2] = 3;
+    ((int*) heap.Get(p2))[3] = 4;
+
+    CompactingHeap::Handle p3 = heap.AllocateZeroed(4 * sizeof(myStruct));
+
+                        /* long running mix: allocate a lot, free most of it */
+    std::vector<CompactingHeap::Handle> handles;
+    for (int i = 0; i < 100000; ++i)
+        handles.push_back(heap.Allocate(size(rng)));
+
+    std::vector<CompactingHeap::Handle> kept;
+    for (size_t i = 0; i < handles.size(); ++i)
+    {
+        if (i % 5 == 0)
+        {
+            kept.push_back(handles[i]);
+            *(int*) heap.Get(handles[i]) = (int) i;
+        }
+        else
+            heap.Free(handles[i]);
+    }
+
+    PrintStats("before compaction", heap.GetStats());
+
+    // incremental: 1 MB per step
+    int steps = 1;
+    while (!heap.CompactStep(1024 * 1024))
+        ++steps;
+
+    PrintStats("after compaction ", heap.GetStats());
+    cout << "compaction steps: " << steps << std::endl;
+
+    bool same = true;
+    for (size_t k = 0; k < kept.size(); ++k)
+        same = same && *(int*) heap.Get(kept[k]) == (int) (k * 5);
+    int* q = (int*) heap.Get(p2);
+    cout << "data kept after moving: " << same << ", p2 = " << q[0] << q[1] << q[2] << q[3]
+         << ", p3[0].i = " << ((myStruct*) heap.Get(p3))->i << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,434 @@
+/*
+- Memory leaks (memory_mng.cpp): data allocated on the heap but not properly deallocated.
+                                 to find who leaks, we need to know the allocation site
+                                 (the call stack) of the memory which is still alive.
+
+- Full tracking: recording the call stack of every new/delete is too slow for production.
+
+- Sampling heap profiler: only one allocation per N bytes (on average) is recorded.
+                          > every thread counts down the allocated bytes, when the counter
+                            reaches zero the allocation is sampled and a new random
+                            interval is chosen (exponential distribution with mean N),
+                            so big and small allocations are sampled fairly.
+                          > the sampled allocation stores its call stack (backtrace) in a
+                            table of live samples, and it is removed from the table on delete.
+                          > a sample of size s stands for s / (1 - exp(-s/N)) bytes on average,
+                            the dump reports this estimated size.
+                          > the fast path of new/delete is a thread local subtraction and
+                            a look up in a small counter array, so the overhead stays small.
+                            main measures it against the same new/delete without the hooks.
+
+- Overloading new and delete: the profiler overloads the global operators new/delete
+                              (see the commented example in memory_mng.cpp) and uses malloc/free.
+
+- Dump: DumpFolded() writes the live samples in the folded stack format
+        "frame1;frame2;...;frameN bytes" which can be used with flamegraph.pl,
+        either by calling the API or by sending SIGUSR2 to the process
+        (kill -USR2 <pid>), then the profile is written to heap_profile.folded.
+
+- To build: g++ -std=c++17 -O2 -g -rdynamic -pthread memory_heap_profiler.cpp
+            (-rdynamic gives function names in backtrace_symbols)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <execinfo.h>
+#include <iostream>
+#include <fstream>
+#include <unordered_map>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <new>
+
+using std::cout;
+
+class HeapProfiler
+{
+    public:
+    static const int MaxFrames = 32;
+
+    struct Sample
+    {
+        size_t size;
+        int frames;
+        void* stack[MaxFrames];
+    };
+
+    // start sampling one allocation per sampleBytes on average
+    // (a thread starts after the interval it is counting down now)
+    static void Start(size_t sampleBytes)
+    {
+        _sampleBytes.store(sampleBytes, std::memory_order_relaxed);
+        _enabled.store(true, std::memory_order_release);
+    }
+
+    static void Stop()
+    {
+        _enabled.store(false, std::memory_order_release);
+    }
+
+    // called by operator new before the memory is allocated, true if the allocation must be recorded
+    static bool CountDown(size_t size)
+    {
+        ThreadState& ts = _thread;
+        if (__builtin_expect(ts.countdown > (long) size, 1))
+        {
+            ts.countdown -= size;
+            return false;
+        }
+        return Due();
+    }
+
+    // called by operator new after an allocation chosen by CountDown
+    static void OnAlloc(void* p, size_t size)
+    {
+        Record(p, size);
+    }
+
+    // called by operator delete before the memory is freed
+    static void OnFree(void* p)
+    {
+        // most pointers were never sampled, one load answers that
+        if (_maybeSampled[Slot(p)].load(std::memory_order_relaxed) == 0)
+            return;
+        // the profiler's own memory is never sampled, and Forget would lock _m a second time
+        // when the live table frees a node (erase, rehash) while _m is held
+        if (_thread.inProfiler)
+            return;
+        Forget(p);
+    }
+
+    // write the live samples as folded stacks with their estimated bytes
+    static void DumpFolded(std::ostream& out)
+    {
+        ThreadState& ts = _thread;
+        ts.inProfiler = true;
+
+        std::unordered_map<void*, Sample> copy;
+        {
+            std::lock_guard<std::mutex> lock(_m);
+            copy = Live();
+        }
+
+        double rate = (double) _sampleBytes.load(std::memory_order_relaxed);
+        std::unordered_map<std::string, double> folded;
+        for (auto& entry : copy)
+        {
+            const Sample& s = entry.second;
+            char** names = backtrace_symbols(s.stack, s.frames);
+            // skip the innermost frames of the profiler itself (Record, ProfiledMalloc, operator new),
+            // by name because inlining changes their number
+            int first = 0;
+            while (names && first < s.frames && ProfilerFrame(names[first]))
+                ++first;
+            std::string key;
+            // print outermost frame first
+            for (int i = s.frames - 1; i >= first; --i)
+            {
+                if (!key.empty())
+                    key += ';';
+                key += names ? names[i] : "?";
+            }
+            free(names);
+            folded[key] += s.size / (1.0 - std::exp(-(double) s.size / rate));
+        }
+        for (auto& entry : folded)
+            out << entry.first << ' ' << (long long) entry.second << '\n';
+
+        ts.inProfiler = false;
+    }
+
+    // dump to path every time the signal arrives, the handler only writes to a pipe
+    static void InstallSignalDump(int sig, const char* path)
+    {
+        if (pipe(_pipe) != 0)
+            return;
+        _dumpPath = path;
+        signal(sig, SignalHandler);
+
+        std::thread([] {
+            char c;
+            while (read(_pipe[0], &c, 1) == 1)
+            {
+                std::ofstream file(_dumpPath);
+                DumpFolded(file);
+            }
+        }).detach();
+    }
+
+    private:
+    struct ThreadState
+    {
+        long countdown = 0;
+        uint64_t rng = 0x9E3779B97F4A7C15ull;
+        bool inProfiler = false;
+    };
+
+    static const size_t Slots = 1 << 16;
+
+    static size_t Slot(void* p)
+    {
+        return ((uintptr_t) p >> 4) * 0x9E3779B97F4A7C15ull >> 48;
+    }
+
+    // slow path of CountDown: the countdown ran out
+    __attribute__((noinline)) static bool Due()
+    {
+        ThreadState& ts = _thread;
+        if (ts.inProfiler)
+            return false;
+        // with sampling off a new interval is counted down too, so the fast path stays the usual case
+        // and Start() takes effect at the end of the current interval
+        ts.countdown = NextInterval(ts);
+        return _enabled.load(std::memory_order_relaxed);
+    }
+
+    static long NextInterval(ThreadState& ts)
+    {
+        // xorshift random number, then exponential distribution with mean sampleBytes
+        ts.rng ^= ts.rng << 13;
+        ts.rng ^= ts.rng >> 7;
+        ts.rng ^= ts.rng << 17;
+        double u = ((ts.rng >> 11) + 1) * (1.0 / 9007199254740993.0);
+        return (long) (-std::log(u) * (double) _sampleBytes.load(std::memory_order_relaxed)) + 1;
+    }
+
+    static void Record(void* p, size_t size)
+    {
+        ThreadState& ts = _thread;
+        ts.inProfiler = true;
+
+        Sample s;
+        s.size = size;
+        s.frames = backtrace(s.stack, MaxFrames);
+        {
+            std::lock_guard<std::mutex> lock(_m);
+            Live()[p] = s;
+        }
+        _maybeSampled[Slot(p)].fetch_add(1, std::memory_order_relaxed);
+
+        ts.inProfiler = false;
+    }
+
+    static void Forget(void* p)
+    {
+        ThreadState& ts = _thread;
+        ts.inProfiler = true;
+        {
+            std::lock_guard<std::mutex> lock(_m);
+            if (Live().erase(p) != 0)
+                _maybeSampled[Slot(p)].fetch_sub(1, std::memory_order_relaxed);
+        }
+        ts.inProfiler = false;
+    }
+
+    // the table is never destroyed, so deletes that run during program exit can still use it
+    static std::unordered_map<void*, Sample>& Live()
+    {
+        static std::unordered_map<void*, Sample>* live = new std::unordered_map<void*, Sample>();
+        return *live;
+    }
+
+    // backtrace_symbols names look like "./a.out(_ZN12HeapProfiler6RecordEPvm+0x2a) [0x...]",
+    // _Znwm / _Znam are operator new and operator new[]. without -rdynamic there are no names
+    // and nothing is skipped
+    static bool ProfilerFrame(const char* name)
+    {
+        return strstr(name, "HeapProfiler") || strstr(name, "ProfiledMalloc")
+            || strstr(name, "_Znwm") || strstr(name, "_Znam");
+    }
+
+    static void SignalHandler(int)
+    {
+        char c = 'd';
+        ssize_t ignored = write(_pipe[1], &c, 1);
+        (void) ignored;
+    }
+
+    static std::atomic<bool> _enabled;
+    static std::atomic<size_t> _sampleBytes;
+    static std::atomic<uint16_t> _maybeSampled[Slots];
+    static std::mutex _m;
+    static thread_local ThreadState _thread;
+    static int _pipe[2];
+    static const char* _dumpPath;
+};
+
+std::atomic<bool> HeapProfiler::_enabled(false);
+std::atomic<size_t> HeapProfiler::_sampleBytes(512 * 1024);
+std::atomic<uint16_t> HeapProfiler::_maybeSampled[HeapProfiler::Slots];
+std::mutex HeapProfiler::_m;
+thread_local HeapProfiler::ThreadState HeapProfiler::_thread;
+int HeapProfiler::_pipe[2] = {-1, -1};
+const char* HeapProfiler::_dumpPath = "heap_profile.folded";
+
+                     /* new/delete overloading */
+/* every form of new/delete goes through this pair, so the compiler always sees malloc matched
+   with free (calling free directly inside operator delete mismatches it with operator new after inlining),
+   the sampling decision is taken before malloc, so the usual case ends with a tail call to malloc */
+__attribute__((noinline)) void* ProfiledMalloc(size_t size)
+{
+    if (!HeapProfiler::CountDown(size))
+        return malloc(size ? size : 1);
+
+    void* p = malloc(size ? size : 1);
+    if (p != NULL)
+        HeapProfiler::OnAlloc(p, size);
+    return p;
+}
+
+__attribute__((noinline)) void ProfiledFree(void* p)
+{
+    if (p == NULL)
+        return;
+    HeapProfiler::OnFree(p);
+    free(p);
+}
+
+void* operator new (size_t size)
+{
+    void* p = ProfiledMalloc(size);
+    if (p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[] (size_t size)
+{
+    void* p = ProfiledMalloc(size);
+    if (p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete (void* p) noexcept
+{
+    ProfiledFree(p);
+}
+
+void operator delete[] (void* p) noexcept
+{
+    ProfiledFree(p);
+}
+
+void operator delete (void* p, size_t) noexcept
+{
+    ProfiledFree(p);
+}
+
+void operator delete[] (void* p, size_t) noexcept
+{
+    ProfiledFree(p);
+}
+
+                     /* example: a leaking function and a clean one */
+struct myStruct
+{
+    int i;
+    double d;
+    char a[5];
+};
+
+// volatile sinks keep the compiler from removing the new/delete pairs
+myStruct* volatile lastLeak;
+int* volatile lastInt;
+
+void Leaky(int n)
+{
+    for (int i = 0; i < n; ++i)
+        lastLeak = new myStruct[64];           // never deleted
+}
+
+void Clean(int n)
+{
+    for (int i = 0; i < n; ++i)
+    {
+        myStruct* p = new myStruct[64];
+        lastLeak = p;
+        delete[] p;
+    }
+}
+
+/* the baseline: what the default operator new/delete do (malloc and free behind one call),
+   without the profiler hooks */
+__attribute__((noinline)) void* UnhookedNew(size_t size)
+{
+    void* p = malloc(size ? size : 1);
+    if (p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+__attribute__((noinline)) void UnhookedDelete(void* p)
+{
+    free(p);
+}
+
+template <bool Hooked>
+double ChurnNs(long n)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+    for (long i = 0; i < n; ++i)
+    {
+        int* p = Hooked ? new int(i) : new (UnhookedNew(sizeof(int))) int(i);
+        lastInt = p;
+        if (Hooked)
+            delete p;
+        else
+            UnhookedDelete(p);
+    }
+    auto stopTime = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::nano>(stopTime - startTime).count() / n;
+}
+
+int main()
+{
+    HeapProfiler::InstallSignalDump(SIGUSR2, "heap_profile.folded");
+
+                        /* overhead of the sampling */
+    // the three cases take turns and the best round of each is kept, so noise of the machine
+    // (other processes, frequency changes) hits them alike
+    const long N = 4000000;
+    double plainNs = 1e9, offNs = 1e9, onNs = 1e9;
+    for (int round = 0; round < 9; ++round)
+    {
+        plainNs = std::min(plainNs, ChurnNs<false>(N));
+        offNs = std::min(offNs, ChurnNs<true>(N));
+        HeapProfiler::Start(512 * 1024);
+        onNs = std::min(onNs, ChurnNs<true>(N));
+        HeapProfiler::Stop();
+    }
+    cout << "new/delete without hooks   : " << plainNs << " ns" << std::endl;
+    cout << "new/delete without sampling: " << offNs << " ns (" << std::showpos << (offNs / plainNs - 1) * 100 << std::noshowpos << " %)" << std::endl;
+    cout << "new/delete with sampling   : " << onNs << " ns (" << std::showpos << (onNs / plainNs - 1) * 100 << std::noshowpos << " %)" << std::endl;
+    HeapProfiler::Start(512 * 1024);
+
+                        /* find the leak */
+    Leaky(20000);
+    Clean(20000);
+
+    cout << "live heap samples (folded):" << std::endl;
+    HeapProfiler::DumpFolded(cout);
+
+                        /* dense sampling: the live table rehashes and erases while samples are freed */
+    HeapProfiler::Start(64);
+    std::vector<int*> ints(40000);
+    for (int*& p : ints)
+        p = new int(1);
+    for (int* p : ints)
+        delete p;
+    HeapProfiler::Stop();
+    cout << "freed " << ints.size() << " densely sampled ints" << std::endl;
+
+    return 0;
+}
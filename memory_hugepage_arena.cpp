@@ -0,0 +1,112 @@
+/*
+- TLB (Translation Lookaside Buffer): a small cache inside the CPU which holds the latest
+                                     virtual to physical address translations (see virtual memory
+                                     in memory_mng.cpp). with normal 4 KB pages a big matrix needs
+                                     many translations, they don't fit in the TLB and each miss
+                                     costs a page table walk.
+
+- Huge pages: 2 MB pages, one TLB entry covers 512 times more memory.
+              > MAP_HUGETLB: explicit huge pages, taken from the pool reserved by the admin
+                             (/proc/sys/vm/nr_hugepages), mmap fails if the pool is empty.
+              > Transparent huge pages (THP): normal mmap memory + madvise (MADV_HUGEPAGE),
+                                              the kernel tries to back the region with huge pages
+                                              but may fall back to 4 KB pages.
+
+- Arena: reserves one large region up front and hands out pieces of it by moving a pointer
+         (bump allocation). single pieces are not freed, the whole region is released
+         when the arena is destroyed.
+
+- std::pmr::memory_resource: the arena derives from it, so any std::pmr container
+                             (std::pmr::vector ...) can allocate from it, like the Matrix of
+                             matrix.h (advanced_oop.cpp) and the board loader of board.h (intro.cpp),
+                             both take the resource as a parameter.
+
+- HugeBytes(): reads /proc/self/smaps to report how many bytes of the region are really
+               on huge pages (AnonHugePages for THP, the whole region for MAP_HUGETLB).
+
+- To build: g++ -std=c++17 -O2 memory_hugepage_arena.cpp
+  To compare TLB misses: perf stat -e dTLB-load-misses ./a.out
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "matrix.h"
+#include "board.h"
+#include "hugepage_arena.h"
+
+using std::cout;
+
+// column by column walk: every access touches a different page, so the TLB is stressed
+long long SumColumns(const Matrix& m)
+{
+    long long sum = 0;
+    for (int j = 0; j < m.Cols(); ++j)
+        for (int i = 0; i < m.Rows(); ++i)
+            sum += m(i, j);
+    return sum;
+}
+
+double SumMs(Matrix& m, long long& sum)
+{
+    for (int i = 0; i < m.Rows(); ++i)
+        for (int j = 0; j < m.Cols(); ++j)
+            m(i, j) = i + j;
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    sum = SumColumns(m);
+    auto stopTime = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(stopTime - startTime).count();
+}
+
+int main()
+{
+    const int N = 8192;     // 8192 x 8192 ints = 256 MB
+
+    long long sumDefault = 0, sumHuge = 0;
+    double defaultMs, hugeMs;
+    {
+        Matrix m(N, N);
+        defaultMs = SumMs(m, sumDefault);
+    }
+
+    HugePageArena arena((size_t) N * N * sizeof(int));
+    {
+        Matrix m(N, N, &arena);
+        hugeMs = SumMs(m, sumHuge);
+    }
+
+    cout << "arena: " << arena.Capacity() / (1024 * 1024) << " MB reserved, "
+         << arena.HugeBytes() / (1024 * 1024) << " MB on huge pages"
+         << (arena.ExplicitHugePages() ? " (MAP_HUGETLB)" : " (THP)") << std::endl;
+    cout << "default heap matrix column sum: " << defaultMs << " ms" << std::endl;
+    cout << "huge page matrix column sum   : " << hugeMs << " ms"
+         << " (same sum " << (sumDefault == sumHuge) << ")" << std::endl;
+
+                        /* board loader: every row is a small vector, all of them come from the arena */
+    char path[] = "/tmp/hugepage_boardXXXXXX";
+    int fd = mkstemp(path);
+    if (fd >= 0)
+    {
+        close(fd);
+        {
+            std::ofstream board(path);
+            for (int row = 0; row < 1000; ++row)
+                board << "0,1,0,0,0,0,\n";
+        }
+
+        HugePageArena boardArena(HugePageArena::HugePageSize);
+        std::pmr::vector<std::pmr::vector<int>> board = ReadBoardFile(path, &boardArena);
+        cout << "board: " << board.size() << " rows read into the arena, "
+             << boardArena.Used() / 1024 << " KB used" << std::endl;
+        unlink(path);
+    }
+
+    return 0;
+}
@@ -0,0 +1,316 @@
+/*
+- Small objects on the heap: MyInit and std::unique_ptr (memory_mng.cpp) always point to memory
+                             allocated with new, even when the object is as small as an int
+                             (RawPointer() / UniquePointer()). for polymorphic objects like Shape
+                             (advanced_oop.cpp) we need a pointer anyway, so every Rectangle or
+                             Circle costs one new and one delete.
+
+- Small buffer optimization: the owner has a small buffer of N bytes inside itself. if the object
+                             fits (size, alignment and a noexcept move constructor), it is constructed
+                             in this buffer, no heap allocation at all. bigger objects fall back to new.
+                             std::string and std::function use the same trick.
+
+- inline_box<T, N, Deleter>: > owns one object of type T or of a class derived from T (polymorphism),
+                               make_inline_box<Derived, T> (args...) creates it.
+                             > move only, like std::unique_ptr: moving an inline object calls the
+                               move constructor of the real (derived) type into the new buffer.
+                             > the object is destroyed with its real type, so T does not need a
+                               virtual destructor (Shape in advanced_oop.cpp doesn't have one).
+                             > a raw heap pointer can be adopted with a custom deleter,
+                               like std::unique_ptr <T, Deleter>.
+
+- To build: g++ -std=c++17 -O2 memory_inline_box.cpp
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+using std::cout;
+
+template <typename T, size_t N = 4 * sizeof(void*), typename Deleter = std::default_delete<T>>
+class inline_box
+{
+    // operations which know the real type of the object
+    struct Ops
+    {
+        T* (*move)(void* dst, T* src);      // move constructs into dst and destroys src
+        void (*destroy)(T* p);              // destroys an inline object
+        void (*deleteHeap)(T* p);           // deletes a heap object created by make_inline_box
+    };
+
+    template <typename U>
+    struct OpsFor
+    {
+        static T* Move(void* dst, T* src)
+        {
+            U* from = static_cast<U*>(src);
+            U* to = new (dst) U(std::move(*from));
+            from->~U();
+            return to;
+        }
+
+        static void Destroy(T* p) { static_cast<U*>(p)->~U(); }
+        // the object was created with placement new in aligned ::operator new memory, see make_inline_box
+        static void DeleteHeap(T* p)
+        {
+            U* u = static_cast<U*>(p);
+            u->~U();
+            ::operator delete (u, std::align_val_t(alignof(U)));
+        }
+
+        static const Ops* Get()
+        {
+            static const Ops ops = { &Move, &Destroy, &DeleteHeap };
+            return &ops;
+        }
+    };
+
+    alignas(std::max_align_t) unsigned char _storage[N];
+    T* _ptr;
+    const Ops* _ops;        // nullptr for an adopted pointer, then _deleter is used
+    Deleter _deleter;
+
+    bool InStorage() const
+    {
+        return (const unsigned char*) _ptr >= _storage && (const unsigned char*) _ptr < _storage + N;
+    }
+
+    void MoveFrom(inline_box& other) noexcept
+    {
+        _ops = other._ops;
+        _deleter = std::move(other._deleter);
+        if (other._ptr != nullptr && other.InStorage())
+            _ptr = _ops->move(_storage, other._ptr);
+        else
+            _ptr = other._ptr;
+        other._ptr = nullptr;
+        other._ops = nullptr;
+    }
+
+    template <typename U, typename B, size_t M, typename... Args>
+    friend inline_box<B, M> make_inline_box(Args&&... args);
+
+    public:
+    // true if an object of type U can be kept inside the box
+    template <typename U>
+    static constexpr bool fits_inline = sizeof(U) <= N && alignof(U) <= alignof(std::max_align_t)
+                                        && std::is_nothrow_move_constructible<U>::value;
+
+    inline_box() noexcept : _ptr(nullptr), _ops(nullptr), _deleter() {}
+
+    // adopts a heap object, like std::unique_ptr
+    explicit inline_box(T* p, Deleter d = Deleter()) noexcept : _ptr(p), _ops(nullptr), _deleter(std::move(d)) {}
+
+    inline_box(const inline_box&) = delete;
+    inline_box& operator= (const inline_box&) = delete;
+
+    inline_box(inline_box&& other) noexcept
+    {
+        MoveFrom(other);
+    }
+
+    inline_box& operator= (inline_box&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    ~inline_box()
+    {
+        reset();
+    }
+
+    void reset() noexcept
+    {
+        if (_ptr == nullptr)
+            return;
+        if (_ops == nullptr)
+            _deleter(_ptr);
+        else if (InStorage())
+            _ops->destroy(_ptr);
+        else
+            _ops->deleteHeap(_ptr);
+        _ptr = nullptr;
+        _ops = nullptr;
+    }
+
+    bool is_inline() const { return _ptr != nullptr && InStorage(); }
+
+    T* get() const { return _ptr; }
+    T& operator* () const { return *_ptr; }
+    T* operator-> () const { return _ptr; }
+    explicit operator bool () const { return _ptr != nullptr; }
+};
+
+// creates a U (T or derived from T) inside the box if it fits, otherwise on the heap
+template <typename U, typename T = U, size_t N = 4 * sizeof(void*), typename... Args>
+inline_box<T, N> make_inline_box(Args&&... args)
+{
+    static_assert(std::is_base_of<T, U>::value || std::is_same<T, U>::value, "U must be T or derived from T");
+
+    typedef inline_box<T, N> Box;
+    Box box;
+    if constexpr (Box::template fits_inline<U>)
+        box._ptr = new (box._storage) U(std::forward<Args>(args)...);
+    else
+    {
+        // over aligned types come here, so the memory must respect alignof(U)
+        void* memory = ::operator new (sizeof(U), std::align_val_t(alignof(U)));
+        try
+        {
+            box._ptr = new (memory) U(std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            ::operator delete (memory, std::align_val_t(alignof(U)));
+            throw;
+        }
+    }
+    box._ops = Box::template OpsFor<U>::Get();
+    return box;
+}
+
+                         /* Shapes from advanced_oop.cpp */
+class Shape
+{
+       public:
+       // pure virtual functions, declared but not defined
+       virtual double Area() const = 0;
+       virtual double Perimeter() const = 0;
+};
+
+class Rectangle : public Shape
+{
+       public:
+       Rectangle (double width, double height) : width_(width), height_(height) {}
+
+       double Area() const override { return width_ * height_; }
+       double Perimeter() const override { return 2 * (width_ + height_); }
+
+       private:
+       double width_, height_;
+};
+
+class Circle : public Shape
+{
+       public:
+       Circle (double radius) : radius_(radius) {}
+
+       double Area() const override { return 3.14159 * radius_ * radius_; }
+       double Perimeter() const override { return 2 * 3.14159 * radius_; }
+
+       private:
+       double radius_;
+};
+
+// too big for the default buffer, goes to the heap
+class Polygon : public Shape
+{
+       public:
+       Polygon () : sides_{1, 2, 3, 4, 5, 6, 7, 8} {}
+
+       double Area() const override { return 0; }
+       double Perimeter() const override
+       {
+              double sum = 0;
+              for (double s : sides_)
+                     sum += s;
+              return sum;
+       }
+
+       private:
+       double sides_[8];
+};
+
+// small but over aligned (one cache line), also goes to the heap
+class alignas(64) Tile : public Shape
+{
+       public:
+       double Area() const override { return 1; }
+       double Perimeter() const override { return 4; }
+};
+
+// custom deleter which prints, like MyInit in memory_mng.cpp
+struct PrintDelete
+{
+    void operator() (int* p) const
+    {
+        cout << " resource" << *p << " deallocated" << std::endl;
+        delete p;
+    }
+};
+
+// fills a vector with n shapes, sums their areas and destroys them, returns ns per shape
+template <typename Box, typename Make>
+double CreateDestroyNs(long n, int rounds, Make make)
+{
+    std::vector<Box> shapes;
+    shapes.reserve(n);
+    double sum = 0;
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < rounds; ++r)
+    {
+        for (long i = 0; i < n; ++i)
+            shapes.push_back(make(i));
+        for (Box& s : shapes)
+            sum += s->Area();
+        shapes.clear();
+    }
+    auto stopTime = std::chrono::high_resolution_clock::now();
+
+    volatile double keep = sum;
+    (void)keep;
+    return std::chrono::duration<double, std::nano>(stopTime - startTime).count() / ((double) n * rounds);
+}
+
+int main()
+{
+                        /* int sized payload like UniquePointer() */
+    inline_box<int> small = make_inline_box<int>(2);
+    cout << "int value " << *small << " inline " << small.is_inline() << std::endl;
+
+    inline_box<int, sizeof(int), PrintDelete> adopted(new int(3));
+    cout << "adopted value " << *adopted << " inline " << adopted.is_inline() << std::endl;
+
+                        /* polymorphic shapes */
+    std::vector<inline_box<Shape>> shapes;
+    shapes.push_back(make_inline_box<Rectangle, Shape>(2.0, 3.0));
+    shapes.push_back(make_inline_box<Circle, Shape>(1.0));
+    shapes.push_back(make_inline_box<Polygon, Shape>());
+    shapes.push_back(make_inline_box<Tile, Shape>());
+
+    // the vector grows and moves the boxes, the inline shapes are moved with their real type
+    for (inline_box<Shape>& s : shapes)
+        cout << "area " << s->Area() << " perimeter " << s->Perimeter()
+             << " inline " << s.is_inline() << std::endl;
+    cout << "Tile 64 byte aligned: " << ((uintptr_t) shapes.back().get() % alignof(Tile) == 0) << std::endl;
+
+                        /* cost compared to std::unique_ptr */
+    const long N = 1000000;
+    // unique_ptr<Shape> can't own a Rectangle: Shape has no virtual destructor
+    double uniqueNs = CreateDestroyNs<std::unique_ptr<Rectangle>>(N, 10, [](long i) {
+        return std::unique_ptr<Rectangle>(new Rectangle((double) i, 2.0));
+    });
+    double boxNs = CreateDestroyNs<inline_box<Shape>>(N, 10, [](long i) {
+        return make_inline_box<Rectangle, Shape>((double) i, 2.0);
+    });
+
+    cout << "unique_ptr<Rectangle> create/destroy: " << uniqueNs << " ns" << std::endl;
+    cout << "inline_box<Shape>     create/destroy: " << boxNs << " ns" << std::endl;
+
+    return 0;
+}
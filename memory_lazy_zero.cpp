@@ -0,0 +1,199 @@
+/*
+- Eager zeroing: calloc (4, sizeof(myStruct)) in memory_mng.cpp gives memory filled with zeros.
+                 for a big table, zero filling (memset, or the constructors of std::vector<T> (n))
+                 touches every page before the program can use the table, so a table of
+                 hundreds of MB delays the startup even if most of it is used much later.
+
+- Lazy zeroing: memory from an anonymous mmap is already zero. the kernel does not give any page at
+                mmap time, on the first touch of a page (page fault) it gives a page filled with
+                zeros. so the cost is paid page by page, only for the pages really used.
+                > ZeroedAlloc (count, size): like calloc, uses mmap for big sizes (>= LazyThreshold)
+                  and calloc for small ones.
+                > ZeroedFree (p, count, size): like free.
+                NB: glibc calloc also uses mmap for very big blocks, but only above its mmap
+                threshold which moves at runtime, and new T[n]() or std::vector always zero eagerly.
+
+- Parallel pre-fault: if the whole table will be used soon, the page faults can be taken up front by
+                      several threads, each one touches its own part of the table.
+                      > NUMA (non uniform memory access): on machines with more than one memory node
+                        a page is placed on the node of the thread which touches it first
+                        (first touch policy), so the thread which will work on a part of the table
+                        should be the one which pre-faults it.
+                      > MADV_POPULATE_WRITE (linux 5.14) faults a range in one system call,
+                        older kernels fall back to adding 0 to one byte per page (a write which
+                        keeps the data).
+
+- To build: g++ -std=c++17 -O2 -pthread memory_lazy_zero.cpp
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <new>
+
+using std::cout;
+
+// from this size on the zeroed memory comes from mmap
+const size_t LazyThreshold = 1 << 20;
+
+size_t PageSize()
+{
+    static const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    return page;
+}
+
+size_t RoundToPages(size_t bytes)
+{
+    return (bytes + PageSize() - 1) / PageSize() * PageSize();
+}
+
+void* ZeroedAlloc(size_t count, size_t size)
+{
+    if (size != 0 && count > (size_t) -1 / size)
+        return NULL;
+    size_t bytes = count * size;
+
+    if (bytes < LazyThreshold)
+        return calloc(count, size);
+
+    void* p = mmap(NULL, RoundToPages(bytes), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+void ZeroedFree(void* p, size_t count, size_t size)
+{
+    if (p == NULL)
+        return;
+    size_t bytes = count * size;
+    if (bytes < LazyThreshold)
+        free(p);
+    else
+        munmap(p, RoundToPages(bytes));
+}
+
+// touches [begin, end) page by page so the kernel gives all the pages now
+void PrefaultRange(char* begin, char* end)
+{
+    if (begin >= end)
+        return;
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(begin, end - begin, MADV_POPULATE_WRITE) == 0)
+        return;
+#endif
+    // a read would only map the shared zero page, a write allocates the real page.
+    // adding 0 atomically is a write which keeps the byte, so data already in the buffer
+    // survives (also if another thread writes it at the same time)
+    for (char* p = begin; p < end; p += PageSize())
+        __atomic_fetch_add(p, 0, __ATOMIC_RELAXED);
+}
+
+// every thread pre-faults its own slice, first touch puts the pages near that thread
+void PrefaultParallel(void* p, size_t bytes, unsigned threads)
+{
+    if (threads == 0)
+        threads = 1;
+    char* base = (char*) p;
+    size_t pages = RoundToPages(bytes) / PageSize();
+    size_t perThread = (pages + threads - 1) / threads;
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        size_t first = t * perThread;
+        size_t last = first + perThread < pages ? first + perThread : pages;
+        if (first >= last)
+            break;
+        workers.emplace_back(PrefaultRange, base + first * PageSize(), base + last * PageSize());
+    }
+    for (std::thread& w : workers)
+        w.join();
+}
+
+struct myStruct
+{
+    int i;
+    double d;
+    char a[5];
+};
+
+double Ms(std::chrono::high_resolution_clock::time_point from)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - from).count();
+}
+
+// reads 1 element of every 64 pages, like a sparse table at startup
+long SparseTouch(const myStruct* table, size_t count)
+{
+    long sum = 0;
+    size_t step = 64 * PageSize() / sizeof(myStruct);
+    for (size_t i = 0; i < count; i += step)
+        sum += table[i].i;
+    return sum;
+}
+
+int main()
+{
+                        /* small: same as calloc */
+    myStruct* p3 = (myStruct*) ZeroedAlloc(4, sizeof(myStruct));
+    if (p3 == NULL)
+    {
+        cout << "ZeroedAlloc failed" << std::endl;
+        return 1;
+    }
+    cout << "small zeroed: " << p3[0].i << " " << p3[3].d << std::endl;
+    ZeroedFree(p3, 4, sizeof(myStruct));
+
+                        /* big table: eager vs lazy */
+    const size_t count = 512ull * 1024 * 1024 / sizeof(myStruct);   // 512 MB
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+    std::vector<myStruct> eager(count);     // value initialization zeroes every element
+    double eagerAllocMs = Ms(t0);
+    t0 = std::chrono::high_resolution_clock::now();
+    long eagerSum = SparseTouch(eager.data(), count);
+    double eagerTouchMs = Ms(t0);
+    std::vector<myStruct>().swap(eager);
+
+    t0 = std::chrono::high_resolution_clock::now();
+    myStruct* lazy = (myStruct*) ZeroedAlloc(count, sizeof(myStruct));
+    double lazyAllocMs = Ms(t0);
+    if (lazy == NULL)
+    {
+        cout << "ZeroedAlloc of 512 MB failed" << std::endl;
+        return 1;
+    }
+    t0 = std::chrono::high_resolution_clock::now();
+    long lazySum = SparseTouch(lazy, count);
+    double lazyTouchMs = Ms(t0);
+    ZeroedFree(lazy, count, sizeof(myStruct));
+
+    cout << "std::vector (eager zero): alloc " << eagerAllocMs << " ms, sparse use " << eagerTouchMs << " ms" << std::endl;
+    cout << "ZeroedAlloc (lazy zero) : alloc " << lazyAllocMs << " ms, sparse use " << lazyTouchMs << " ms"
+         << " (same sums " << (eagerSum == lazySum) << ")" << std::endl;
+
+                        /* full use soon: pre-fault with 1 and with all threads */
+    unsigned cores = std::thread::hardware_concurrency();
+    for (unsigned threads : {1u, cores})
+    {
+        myStruct* table = (myStruct*) ZeroedAlloc(count, sizeof(myStruct));
+        if (table == NULL)
+        {
+            cout << "ZeroedAlloc of 512 MB failed" << std::endl;
+            return 1;
+        }
+        table[count - 1].i = 42;     // data written before the pre-fault must stay
+        t0 = std::chrono::high_resolution_clock::now();
+        PrefaultParallel(table, count * sizeof(myStruct), threads);
+        cout << "pre-fault 512 MB with " << threads << " thread(s): " << Ms(t0) << " ms"
+             << " (data kept " << (table[count - 1].i == 42) << ")" << std::endl;
+        ZeroedFree(table, count, sizeof(myStruct));
+    }
+
+    return 0;
+}
@@ -0,0 +1,130 @@
+/*
+- Cost of Myclass: Myclass (memory_mng.cpp) calls malloc in its constructor and free in its
+                   destructor, and new/delete of the object itself is another malloc/free,
+                   so every object created and destroyed costs two heap allocations.
+
+- Object pool: keeps the memory of the objects (slots) and reuses it instead of returning
+               it to the heap.
+               > slots are allocated in chunks (many slots in one allocation), the chunks are found
+                 through a two level directory which grows with the pool.
+               > Acquire(args...) constructs a new object in a free (raw) slot.
+               > with keepConstructed = true, released objects are not destroyed, the next
+                 Acquire() hands out the already constructed object again, so even the
+                 malloc inside the Myclass constructor is not repeated.
+
+- Handle: Acquire returns a PoolPtr, it behaves like a std::unique_ptr (move only, -> and *)
+          but on destruction it gives the slot back to the pool instead of calling delete.
+
+- Thread local cache: every thread keeps its own short list of free slots inside the pool
+                      (one cache line per thread, so threads don't share it), acquire and release
+                      use it first without any atomic operation. if it grows too long, half of it
+                      goes back to the shared free list.
+
+- Lock-free free list: the shared free slots are kept in a stack (Treiber stack) changed with
+                       compare_exchange only, no mutex on the fast path.
+                       > ABA problem: a slot can be popped and pushed again between reading the
+                         head and the compare_exchange, so the head holds the slot index plus
+                         a tag which changes on every push/pop.
+                       > the mutex is only taken when the free list is empty to add a new chunk.
+
+- To build: g++ -std=c++17 -O2 -pthread memory_object_pool.cpp
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include "object_pool.h"
+
+using std::cout;
+
+// Myclass from memory_mng.cpp without the prints
+class Myclass
+{
+    private:
+    int* ptr;
+
+    public:
+    Myclass()
+    {
+        ptr = (int *) malloc (sizeof(int));
+    }
+
+    ~Myclass()
+    {
+        free(ptr);
+    }
+
+    void SetNumber(int num)
+    {
+        *ptr = num;
+    }
+
+    int GetNumber() const
+    {
+        return *ptr;
+    }
+};
+
+                            /* Benchmark */
+// every thread creates, uses and destroys n objects, returns objects per microsecond
+template <typename Work>
+double Churn(int threads, long n, Work work)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; ++t)
+        pool.emplace_back([&] {
+            for (long i = 0; i < n; ++i)
+                work((int) i);
+        });
+    for (std::thread& t : pool)
+        t.join();
+    auto stopTime = std::chrono::high_resolution_clock::now();
+    return n * threads / std::chrono::duration<double, std::micro>(stopTime - startTime).count();
+}
+
+int main()
+{
+    ObjectPool<Myclass> pool;
+    {
+        PoolPtr<Myclass> a = pool.Acquire();
+        a->SetNumber(42);
+        cout << "pooled Myclass number: " << a->GetNumber() << std::endl;
+    }
+
+    const long N = 5000000;
+    ObjectPool<Myclass> rawPool(false);
+    ObjectPool<Myclass> keptPool(true);
+    std::atomic<long> sink(0);
+
+    for (int threads = 1; threads <= 4; threads *= 2)
+    {
+        double heap = Churn(threads, N, [&](int i) {
+            Myclass* p = new Myclass();
+            p->SetNumber(i);
+            sink.fetch_add(p->GetNumber() & 1, std::memory_order_relaxed);
+            delete p;
+        });
+        double raw = Churn(threads, N, [&](int i) {
+            PoolPtr<Myclass> p = rawPool.Acquire();
+            p->SetNumber(i);
+            sink.fetch_add(p->GetNumber() & 1, std::memory_order_relaxed);
+        });
+        double kept = Churn(threads, N, [&](int i) {
+            PoolPtr<Myclass> p = keptPool.Acquire();
+            p->SetNumber(i);
+            sink.fetch_add(p->GetNumber() & 1, std::memory_order_relaxed);
+        });
+
+        cout << "threads " << threads
+             << "  new/delete: " << heap << " obj/us"
+             << "  pool (construct): " << raw << " obj/us"
+             << "  pool (keep constructed): " << kept << " obj/us" << std::endl;
+    }
+
+    return 0;
+}
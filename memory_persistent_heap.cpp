@@ -0,0 +1,159 @@
+/*
+- Problem: heap data structures (lists, maps, matrices) live only as long as the process,
+           so after every restart they are built again from scratch (read + parse + allocate).
+
+- Persistent heap: the heap memory is a file mapped into memory with mmap (MAP_SHARED).
+                   everything allocated from it is written to the file by the OS, so after a
+                   restart the file is mapped again and the data structures are used immediately,
+                   there is no deserialization.
+
+- Offset pointers: the file may be mapped at a different address next time, so a normal pointer
+                   stored inside the file would point to garbage. offset_ptr<T> stores the
+                   distance between itself and the target instead of the address, it stays
+                   correct wherever the file is mapped (like boost::interprocess::offset_ptr).
+
+- Root directory: a small table at the start of the file maps a name to an object, so after
+                  reopening we can find our objects: Root<T> ("name") or Construct<T> ("name", args).
+
+- Allocation: first fit free list (blocks with a size header) + bump allocation at the end,
+              all kept inside the file with offsets.
+
+- std::pmr::memory_resource: the heap derives from it, so std::pmr containers can allocate from
+                             the mapped region. their internal pointers are normal pointers, so
+                             they are valid while the file is mapped, data which must survive a
+                             restart uses offset_ptr (PList, PMatrix below).
+
+- Crash consistency: the header has a "clean" flag. it is cleared (and flushed with msync) when
+                     the file is opened for writing, and set again after the final msync in Close().
+                     if the flag is not set when opening, the last run crashed and the data may be
+                     half written, so Open() reports it and the caller can rebuild.
+
+- To build: g++ -std=c++17 -O2 memory_persistent_heap.cpp
+  Run it twice: the second run finds the list and the matrix of the first run
+  (the file is persistent_heap.bin in the temp directory, or the path given as argument).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <string>
+#include <filesystem>
+#include <memory_resource>
+#include <vector>
+#include <stdexcept>
+#include <new>
+#include "persistent_heap.h"
+
+using std::cout;
+
+                            /* Persistent data structures */
+// singly linked list like linked_list.cpp, with offset pointers
+struct PNode
+{
+    int data;
+    offset_ptr<PNode> next;
+};
+
+struct PList
+{
+    offset_ptr<PNode> head;
+    offset_ptr<PNode> tail;
+    int count = 0;
+
+    void AddLast(PersistentHeap& heap, int value)
+    {
+        PNode* n = new (heap.Allocate(sizeof(PNode))) PNode();
+        n->data = value;
+        if (tail)
+            tail->next = n;
+        else
+            head = n;
+        tail = n;
+        ++count;
+    }
+};
+
+// Matrix like advanced_oop.cpp, values in the persistent heap
+struct PMatrix
+{
+    int rows;
+    int cols;
+    offset_ptr<int> values;
+
+    PMatrix(PersistentHeap& heap, int r, int c) : rows(r), cols(c)
+    {
+        values = (int*) heap.Allocate(sizeof(int) * r * c);
+        for (int i = 0; i < r * c; ++i)
+            values[i] = 0;
+    }
+
+    int& operator() (int row, int col) { return values[row * cols + col]; }
+};
+
+int main(int argc, char* argv[])
+{
+    std::string defaultPath = (std::filesystem::temp_directory_path() / "persistent_heap.bin").string();
+    const char* path = argc > 1 ? argv[1] : defaultPath.c_str();
+
+    PersistentHeap heap;
+    bool created = false, wasClean = false;
+    if (!heap.Open(path, 16 * 1024 * 1024, created, wasClean))
+    {
+        cout << "can't open " << path << std::endl;
+        return 1;
+    }
+
+    if (!created && !wasClean)
+        cout << "warning: " << path << " was not closed cleanly, data may be incomplete" << std::endl;
+
+    PList* list = heap.Root<PList>("list");
+    PMatrix* matrix = heap.Root<PMatrix>("matrix");
+    if (list == nullptr)
+    {
+        cout << "new heap file, building the structures" << std::endl;
+        list = heap.Construct<PList>("list");
+        matrix = heap.Construct<PMatrix>("matrix", heap, 3, 3);
+    }
+    else
+        cout << "reopened heap file, no deserialization needed" << std::endl;
+
+    // every run appends one element and increases the diagonal
+    list->AddLast(heap, list->count + 1);
+    for (int i = 0; i < 3; ++i)
+        (*matrix)(i, i) += 1;
+
+    cout << "list:";
+    for (PNode* n = list->head.get(); n != nullptr; n = n->next.get())
+        cout << " " << n->data;
+    cout << std::endl;
+
+    cout << "matrix:" << std::endl;
+    for (int i = 0; i < matrix->rows; ++i)
+    {
+        for (int j = 0; j < matrix->cols; ++j)
+            cout << (*matrix)(i, j) << " ";
+        cout << std::endl;
+    }
+    cout << "heap bytes used: " << heap.Used() << std::endl;
+
+    // a pmr container on the mapped region, for data of this run only (raw pointers inside)
+    {
+        std::pmr::vector<int> scratch(&heap);
+        for (int i = 0; i < 1000; ++i)
+            scratch.push_back(i);
+        cout << "pmr vector in the heap, last " << scratch.back() << ", heap bytes used: " << heap.Used() << std::endl;
+    }
+
+    // names are unique
+    try
+    {
+        heap.Construct<PList>("list");
+    }
+    catch (const std::invalid_argument& e)
+    {
+        cout << "Construct(\"list\") again: " << e.what() << std::endl;
+    }
+
+    heap.Close();
+    return 0;
+}
@@ -0,0 +1,402 @@
+/*
+- Memory reclamation problem: in a lock-free structure (for example a linked list where nodes are
+                              removed without a mutex) a thread can remove a node while another
+                              thread is still reading it. if the node is deleted immediately,
+                              the reader uses freed memory (use after free).
+                              so a removed node is retired: it is deleted later, when no reader
+                              can hold a pointer to it anymore.
+
+- Hazard pointers: every reader publishes the pointer it is going to use in its hazard slot
+                   (a per thread atomic pointer), then checks that the pointer is still the current one.
+                   > Retire (p, deleter): p is put in the thread's retired list.
+                   > when the list is long enough, the thread scans all the hazard slots and
+                     deletes every retired pointer which is not published by any thread.
+                   > the number of not yet deleted nodes is bounded, but each read costs a
+                     store + memory fence.
+
+- Epoch based reclamation (EBR): there is a global epoch number, a reader enters a critical
+                                 section by announcing the current epoch and leaves it after reading.
+                                 > Retire (p, deleter): p is tagged with the global epoch.
+                                 > the global epoch can move forward only when every thread inside a
+                                   critical section has seen the current epoch, so memory retired two
+                                   epochs ago can't be used by anybody and is deleted.
+                                 > reads are cheaper than hazard pointers, but one stalled reader
+                                   stops all the deletions.
+
+- One interface: both domains have
+                 > a Guard (RAII like lock_guard) to protect the reads,
+                   T* Guard::Protect (const std::atomic<T*>& src) gives a pointer which is safe to use
+                   until the guard goes out of scope.
+                 > Retire (ptr, deleter) to hand over removed memory.
+                 so the same lock-free code can be written once as a template for both of them.
+
+- Threads: a domain keeps one record per thread (thread_index.h), at most ThreadIndex::Max threads
+           can use it at the same time, Guard/Retire throw std::length_error for the others.
+
+- To build: g++ -std=c++17 -O2 -pthread memory_reclamation.cpp
+*/
+
+#include <iostream>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include "thread_index.h"
+
+using std::cout;
+
+typedef void (*Deleter)(void*);
+
+struct Retired
+{
+    void* ptr;
+    Deleter deleter;
+    uint64_t epoch;     // only used by EBR
+};
+
+// a domain has one record per thread, more than ThreadIndex::Max threads alive can't use it
+inline int CheckedThreadIndex()
+{
+    int t = ThreadIndex::Get();
+    if (t >= ThreadIndex::Max)
+        throw std::length_error("reclamation domain: more than ThreadIndex::Max threads");
+    return t;
+}
+
+template <typename T>
+void DefaultDelete(void* p)
+{
+    delete static_cast<T*>(p);
+}
+
+                            /* Hazard pointers */
+class HazardPointers
+{
+    public:
+    static const int SlotsPerThread = 2;
+    // retired pointers per thread before scanning the hazard slots
+    static const size_t ScanThreshold = 128;
+
+    class Guard
+    {
+        HazardPointers& _d;
+        std::atomic<void*>& _slot;
+
+        public:
+        explicit Guard(HazardPointers& d, int slot = 0)
+            : _d(d), _slot(d.Record().hazard[slot]) {}
+
+        ~Guard()
+        {
+            _slot.store(nullptr, std::memory_order_release);
+        }
+
+        Guard(const Guard&) = delete;
+        Guard& operator= (const Guard&) = delete;
+
+        // publish the pointer, then make sure it was not replaced meanwhile
+        template <typename T>
+        T* Protect(const std::atomic<T*>& src)
+        {
+            T* p = src.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                _slot.store(p, std::memory_order_seq_cst);
+                T* again = src.load(std::memory_order_seq_cst);
+                if (again == p)
+                    return p;
+                p = again;
+            }
+        }
+    };
+
+    ~HazardPointers()
+    {
+        // no reader is left, everything can go
+        for (ThreadRecord& r : _records)
+            for (Retired& x : r.retired)
+                x.deleter(x.ptr);
+    }
+
+    void Retire(void* p, Deleter deleter)
+    {
+        ThreadRecord& r = Record();
+        r.retired.push_back(Retired{p, deleter, 0});
+        if (r.retired.size() >= ScanThreshold)
+            Scan(r);
+    }
+
+    template <typename T>
+    void Retire(T* p)
+    {
+        Retire(p, &DefaultDelete<T>);
+    }
+
+    private:
+    struct alignas(64) ThreadRecord
+    {
+        std::atomic<void*> hazard[SlotsPerThread] = {};
+        std::vector<Retired> retired;
+    };
+
+    ThreadRecord& Record()
+    {
+        return _records[CheckedThreadIndex()];
+    }
+
+    void Scan(ThreadRecord& r)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::vector<void*> hazards;
+        for (ThreadRecord& other : _records)
+            for (int i = 0; i < SlotsPerThread; ++i)
+                if (void* h = other.hazard[i].load(std::memory_order_acquire))
+                    hazards.push_back(h);
+        std::sort(hazards.begin(), hazards.end());
+
+        std::vector<Retired> keep;
+        for (Retired& x : r.retired)
+        {
+            if (std::binary_search(hazards.begin(), hazards.end(), x.ptr))
+                keep.push_back(x);
+            else
+                x.deleter(x.ptr);
+        }
+        r.retired.swap(keep);
+    }
+
+    ThreadRecord _records[ThreadIndex::Max];
+};
+
+                            /* Epoch based reclamation */
+class EpochReclamation
+{
+    public:
+    class Guard
+    {
+        EpochReclamation& _d;
+
+        public:
+        explicit Guard(EpochReclamation& d) : _d(d)
+        {
+            _d.Enter();
+        }
+
+        ~Guard()
+        {
+            _d.Exit();
+        }
+
+        Guard(const Guard&) = delete;
+        Guard& operator= (const Guard&) = delete;
+
+        // inside the critical section every loaded pointer is safe
+        template <typename T>
+        T* Protect(const std::atomic<T*>& src)
+        {
+            return src.load(std::memory_order_acquire);
+        }
+    };
+
+    EpochReclamation() : _epoch(2) {}
+
+    ~EpochReclamation()
+    {
+        for (ThreadRecord& r : _records)
+            for (Retired& x : r.retired)
+                x.deleter(x.ptr);
+    }
+
+    void Retire(void* p, Deleter deleter)
+    {
+        ThreadRecord& r = Record();
+        r.retired.push_back(Retired{p, deleter, _epoch.load(std::memory_order_acquire)});
+        if (r.retired.size() >= 64)
+        {
+            TryAdvance();
+            Collect(r);
+        }
+    }
+
+    template <typename T>
+    void Retire(T* p)
+    {
+        Retire(p, &DefaultDelete<T>);
+    }
+
+    private:
+    // announced = 0 means the thread is not inside a critical section
+    struct alignas(64) ThreadRecord
+    {
+        std::atomic<uint64_t> announced{0};
+        int depth = 0;
+        std::vector<Retired> retired;
+    };
+
+    ThreadRecord& Record()
+    {
+        return _records[CheckedThreadIndex()];
+    }
+
+    void Enter()
+    {
+        ThreadRecord& r = Record();
+        if (r.depth++ == 0)
+        {
+            r.announced.store(_epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    void Exit()
+    {
+        ThreadRecord& r = Record();
+        if (--r.depth == 0)
+            r.announced.store(0, std::memory_order_release);
+    }
+
+    // the epoch moves forward if every thread in a critical section has seen it
+    void TryAdvance()
+    {
+        uint64_t current = _epoch.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for (ThreadRecord& other : _records)
+        {
+            uint64_t e = other.announced.load(std::memory_order_acquire);
+            if (e != 0 && e != current)
+                return;
+        }
+        _epoch.compare_exchange_strong(current, current + 1, std::memory_order_acq_rel);
+    }
+
+    void Collect(ThreadRecord& r)
+    {
+        uint64_t current = _epoch.load(std::memory_order_acquire);
+        std::vector<Retired> keep;
+        for (Retired& x : r.retired)
+        {
+            if (x.epoch + 2 <= current)
+                x.deleter(x.ptr);
+            else
+                keep.push_back(x);
+        }
+        r.retired.swap(keep);
+    }
+
+    std::atomic<uint64_t> _epoch;
+    ThreadRecord _records[ThreadIndex::Max];
+};
+
+                            /* Example: copy on write shared node */
+struct Node
+{
+    long value;
+    long check;     // always equal to value * 2, a freed node would break it
+};
+
+// the same reader/writer code for both domains
+template <typename Domain>
+long Read(Domain& domain, const std::atomic<Node*>& current)
+{
+    typename Domain::Guard guard(domain);
+    Node* n = guard.Protect(current);
+    return n->value * 2 == n->check ? n->value : -1;
+}
+
+template <typename Domain>
+void Write(Domain& domain, std::atomic<Node*>& current, long value)
+{
+    Node* old = current.exchange(new Node{value, value * 2}, std::memory_order_acq_rel);
+    domain.Retire(old);
+}
+
+// readers read all the time, one writer replaces the node; returns ns per read
+template <typename ReadFn, typename WriteFn>
+double ReadOverheadNs(int readers, long readsPerThread, ReadFn read, WriteFn write)
+{
+    std::atomic<bool> done(false);
+    std::atomic<long> errors(0);
+
+    std::thread writer([&] {
+        long v = 1;
+        while (!done.load(std::memory_order_relaxed))
+        {
+            write(v++);
+            std::this_thread::yield();
+        }
+    });
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < readers; ++t)
+        threads.emplace_back([&] {
+            long bad = 0;
+            for (long i = 0; i < readsPerThread; ++i)
+                bad += read() < 0;
+            errors += bad;
+        });
+    for (std::thread& t : threads)
+        t.join();
+    auto stopTime = std::chrono::high_resolution_clock::now();
+
+    done = true;
+    writer.join();
+    if (errors != 0)
+        cout << "  broken reads: " << errors << std::endl;
+
+    return std::chrono::duration<double, std::nano>(stopTime - startTime).count() / readsPerThread;
+}
+
+int main()
+{
+    const long N = 5000000;
+
+    for (int readers = 1; readers <= 4; readers *= 2)
+    {
+        // plain mutex
+        std::mutex m;
+        Node* locked = new Node{0, 0};
+        double mutexNs = ReadOverheadNs(readers, N,
+            [&] { std::lock_guard<std::mutex> lock(m); return locked->value; },
+            [&] (long v) {
+                Node* n = new Node{v, v * 2};
+                Node* old;
+                {
+                    std::lock_guard<std::mutex> lock(m);
+                    old = locked;
+                    locked = n;
+                }
+                delete old;
+            });
+        delete locked;
+
+        double hpNs, ebrNs;
+        {
+            HazardPointers hp;
+            std::atomic<Node*> current(new Node{0, 0});
+            hpNs = ReadOverheadNs(readers, N,
+                [&] { return Read(hp, current); },
+                [&] (long v) { Write(hp, current, v); });
+            delete current.load();
+        }
+        {
+            EpochReclamation ebr;
+            std::atomic<Node*> current(new Node{0, 0});
+            ebrNs = ReadOverheadNs(readers, N,
+                [&] { return Read(ebr, current); },
+                [&] (long v) { Write(ebr, current, v); });
+            delete current.load();
+        }
+
+        cout << "readers " << readers
+             << "  mutex: " << mutexNs << " ns/read"
+             << "  hazard pointers: " << hpNs << " ns/read"
+             << "  epochs: " << ebrNs << " ns/read" << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,291 @@
+/*
+- Cost of std::shared_ptr copies: every copy of a shared pointer increases the
+                                  reference counter (use_count) and every destruction
+                                  decreases it again.
+                                  > the counter is atomic, so each copy/destroy is an
+                                    atomic read-modify-write even if the pointer is
+                                    never shared across threads.
+                                  > std::shared_ptr <T> p (new T) allocates a separate
+                                    control block for the counters, so the object and
+                                    its counter live in two different heap blocks.
+
+- Intrusive reference counting: the counter is embedded next to the object itself
+                                (same heap block) instead of in a separate control block.
+                                > make_ref <T> (args...) does one single allocation
+                                  for the counters and the object.
+
+- Counting policy: the pointer takes a policy as a template parameter
+                   > NonAtomicCount : plain ++/-- , only for single threaded hot paths.
+                   > AtomicCount    : std::atomic counter, safe to share across threads.
+
+- Weak reference: WeakRef does not keep the object alive (it does not increase the
+                  strong counter) but it keeps the memory block alive so that it
+                  can check if the object is still there.
+                  > when strong count reaches zero, the object destructor is called.
+                  > when weak count reaches zero too, the memory block is freed.
+                  > lock() returns a RefPtr if the object is still alive, otherwise an empty one.
+
+- NB: libstdc++ switches shared_ptr to non-atomic counting while the process has only one
+      thread, so the benchmark starts a thread first to measure the real (atomic) cost.
+
+- To build: g++ -std=c++17 -O2 -pthread memory_refptr.cpp
+*/
+
+#include <iostream>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <thread>
+#include <utility>
+#include <cstddef>
+
+using std::cout;
+
+                            /* Counting policies */
+struct NonAtomicCount
+{
+    typedef long type;
+
+    static void increment(type& c) { ++c; }
+
+    // returns the new value after decrement
+    static long decrement(type& c) { return --c; }
+
+    static long load(const type& c) { return c; }
+
+    // increment only if the counter is not zero (used by WeakRef::lock)
+    static bool incrementIfNotZero(type& c)
+    {
+        if (c == 0)
+            return false;
+        ++c;
+        return true;
+    }
+};
+
+struct AtomicCount
+{
+    typedef std::atomic<long> type;
+
+    static void increment(type& c) { c.fetch_add(1, std::memory_order_relaxed); }
+
+    static long decrement(type& c) { return c.fetch_sub(1, std::memory_order_acq_rel) - 1; }
+
+    static long load(const type& c) { return c.load(std::memory_order_acquire); }
+
+    static bool incrementIfNotZero(type& c)
+    {
+        long old = c.load(std::memory_order_relaxed);
+        while (old != 0)
+        {
+            if (c.compare_exchange_weak(old, old + 1, std::memory_order_acq_rel))
+                return true;
+        }
+        return false;
+    }
+};
+
+/* the memory block holding the counters and the object together
+   strong: number of RefPtr owners
+   weak  : number of WeakRef observers + 1 while strong is not zero */
+template <typename T, typename Policy>
+struct RefBlock
+{
+    typename Policy::type strong;
+    typename Policy::type weak;
+    alignas(T) unsigned char storage[sizeof(T)];
+
+    RefBlock() : strong(1), weak(1) {}
+
+    T* object() { return reinterpret_cast<T*>(storage); }
+};
+
+template <typename T, typename Policy> class WeakRef;
+
+template <typename T, typename Policy = NonAtomicCount>
+class RefPtr
+{
+    typedef RefBlock<T, Policy> Block;
+    Block* _b;
+
+    explicit RefPtr(Block* b) : _b(b) {}
+
+    void release()
+    {
+        if (_b == nullptr)
+            return;
+        if (Policy::decrement(_b->strong) == 0)
+        {
+            // last owner: destroy the object, then drop the weak reference held by the owners
+            _b->object()->~T();
+            if (Policy::decrement(_b->weak) == 0)
+                delete _b;
+        }
+        _b = nullptr;
+    }
+
+    template <typename U, typename P, typename... Args>
+    friend RefPtr<U, P> make_ref(Args&&... args);
+    friend class WeakRef<T, Policy>;
+
+    public:
+    RefPtr() : _b(nullptr) {}
+
+    RefPtr(const RefPtr& other) : _b(other._b)
+    {
+        if (_b != nullptr)
+            Policy::increment(_b->strong);
+    }
+
+    RefPtr(RefPtr&& other) noexcept : _b(other._b)
+    {
+        other._b = nullptr;
+    }
+
+    RefPtr& operator= (RefPtr other) noexcept
+    {
+        std::swap(_b, other._b);
+        return *this;
+    }
+
+    ~RefPtr()
+    {
+        release();
+    }
+
+    void reset() { release(); }
+
+    T* get() const { return _b ? _b->object() : nullptr; }
+    T& operator* () const { return *_b->object(); }
+    T* operator-> () const { return _b->object(); }
+    explicit operator bool () const { return _b != nullptr; }
+
+    long use_count() const { return _b ? Policy::load(_b->strong) : 0; }
+};
+
+template <typename T, typename Policy = NonAtomicCount, typename... Args>
+RefPtr<T, Policy> make_ref(Args&&... args)
+{
+    typedef RefBlock<T, Policy> Block;
+
+    // single allocation for counters and object
+    Block* b = new Block();
+    try
+    {
+        new (b->storage) T(std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+        delete b;
+        throw;
+    }
+    return RefPtr<T, Policy>(b);
+}
+
+template <typename T, typename Policy = NonAtomicCount>
+class WeakRef
+{
+    typedef RefBlock<T, Policy> Block;
+    Block* _b;
+
+    void release()
+    {
+        if (_b != nullptr && Policy::decrement(_b->weak) == 0)
+            delete _b;
+        _b = nullptr;
+    }
+
+    public:
+    WeakRef() : _b(nullptr) {}
+
+    WeakRef(const RefPtr<T, Policy>& p) : _b(p._b)
+    {
+        if (_b != nullptr)
+            Policy::increment(_b->weak);
+    }
+
+    WeakRef(const WeakRef& other) : _b(other._b)
+    {
+        if (_b != nullptr)
+            Policy::increment(_b->weak);
+    }
+
+    WeakRef& operator= (WeakRef other) noexcept
+    {
+        std::swap(_b, other._b);
+        return *this;
+    }
+
+    ~WeakRef()
+    {
+        release();
+    }
+
+    bool expired() const { return _b == nullptr || Policy::load(_b->strong) == 0; }
+
+    RefPtr<T, Policy> lock() const
+    {
+        if (_b != nullptr && Policy::incrementIfNotZero(_b->strong))
+            return RefPtr<T, Policy>(_b);
+        return RefPtr<T, Policy>();
+    }
+};
+
+                            /* Microbenchmark */
+// copy and destroy the pointer N times and measure nanoseconds per copy/destroy pair
+template <typename Ptr>
+double CopyDestroyNs(const Ptr& source, long n)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+    long sink = 0;
+    for (long i = 0; i < n; ++i)
+    {
+        Ptr copy = source;
+        sink += *copy;
+    }
+    auto stopTime = std::chrono::high_resolution_clock::now();
+
+    // keep the loop from being optimized away
+    volatile long keep = sink;
+    (void)keep;
+
+    return std::chrono::duration<double, std::nano>(stopTime - startTime).count() / n;
+}
+
+int main()
+{
+                        /* RefPtr example */
+    RefPtr<int> ref1 = make_ref<int>(42);
+    cout << " ref pointer count = " << ref1.use_count() << std::endl;
+
+    WeakRef<int> weak(ref1);
+    {
+        RefPtr<int> ref2 = ref1;
+        cout << " ref pointer count = " << ref1.use_count() << std::endl;
+    }
+    cout << " ref pointer count = " << ref1.use_count() << std::endl;
+
+    if (RefPtr<int> locked = weak.lock())
+        cout << " weak lock value = " << *locked << std::endl;
+
+    ref1.reset();
+    cout << " weak expired after reset = " << weak.expired() << std::endl;
+
+                        /* copy/destroy cost compared to shared_ptr */
+    const long N = 50000000;
+
+    // make the process multi threaded so shared_ptr uses its atomic counter
+    std::thread idle([] {});
+    idle.join();
+
+    std::shared_ptr<int> shared = std::make_shared<int>(1);
+    RefPtr<int, AtomicCount> atomicRef = make_ref<int, AtomicCount>(1);
+    RefPtr<int, NonAtomicCount> plainRef = make_ref<int, NonAtomicCount>(1);
+
+    cout << "shared_ptr          : " << CopyDestroyNs(shared, N) << " ns/copy" << std::endl;
+    cout << "RefPtr<AtomicCount> : " << CopyDestroyNs(atomicRef, N) << " ns/copy" << std::endl;
+    cout << "RefPtr<NonAtomic>   : " << CopyDestroyNs(plainRef, N) << " ns/copy" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,187 @@
+/*
+- Growing a buffer: in memory_mng.cpp, realloc (p2, 4 * sizeof(int)) resizes the block of p2.
+                    if there is free space after the block, it grows in place without copying,
+                    otherwise it allocates a new block, copies the data and frees the old one.
+
+- std::vector growth: std::vector never uses realloc, because it has to call the move
+                      constructor and destructor of every element. so on every growth it
+                      allocates a new buffer, moves (copies) all the elements and frees the old one.
+                      for a multi GB buffer of integers this copy costs seconds.
+
+- Trivially relocatable types: types like int, double or a plain struct can be moved to another
+                               address by copying their bytes (memcpy), so for them realloc is safe.
+                               here std::is_trivially_copyable is used to check this.
+
+- mremap (linux): large buffers are allocated directly with mmap (whole pages).
+                  mremap (old, oldSize, newSize, MREMAP_MAYMOVE) grows the mapping and if it
+                  has to move it, the kernel only changes the page tables, no data is copied.
+
+- RelocVector<T>: > small buffers (below LargeThreshold) grow with realloc.
+                  > when the buffer becomes large, it moves once into an mmap region.
+                  > large buffers grow with mremap.
+
+- To build: g++ -std=c++17 -O2 memory_relocvector.cpp
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // for mremap
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <new>
+#include <type_traits>
+#include <cstddef>
+
+using std::cout;
+
+template <typename T>
+class RelocVector
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "RelocVector needs a trivially relocatable (trivially copyable) type");
+
+    T* _data;
+    size_t _size;
+    size_t _capacity;
+    bool _mapped;       // true when _data comes from mmap, false when it comes from malloc
+
+    static size_t PageSize()
+    {
+        static const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+        return page;
+    }
+
+    static size_t RoundToPages(size_t bytes)
+    {
+        size_t page = PageSize();
+        return (bytes + page - 1) / page * page;
+    }
+
+    void Grow(size_t minCapacity)
+    {
+        size_t newCapacity = _capacity ? _capacity * 2 : 16;
+        if (newCapacity < minCapacity)
+            newCapacity = minCapacity;
+
+        size_t newBytes = newCapacity * sizeof(T);
+
+        if (newBytes < LargeThreshold)
+        {
+            // small buffer: realloc grows in place when it can
+            void* p = realloc(_data, newBytes);
+            if (p == NULL)
+                throw std::bad_alloc();
+            _data = (T*) p;
+        }
+        else
+        {
+            newBytes = RoundToPages(newBytes);
+            void* p;
+            if (_mapped)
+            {
+                // large buffer: the kernel moves the pages, no copy
+                p = mremap(_data, RoundToPages(_capacity * sizeof(T)), newBytes, MREMAP_MAYMOVE);
+            }
+            else
+            {
+                // first time above the threshold: move once from the heap into a mapping
+                p = mmap(NULL, newBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (p != MAP_FAILED)
+                {
+                    memcpy(p, _data, _size * sizeof(T));
+                    free(_data);
+                    _mapped = true;
+                }
+            }
+            if (p == MAP_FAILED)
+                throw std::bad_alloc();
+            _data = (T*) p;
+            newCapacity = newBytes / sizeof(T);
+        }
+        _capacity = newCapacity;
+    }
+
+    public:
+    // buffers from this size on use mmap/mremap
+    static const size_t LargeThreshold = 1 << 20;
+
+    RelocVector() : _data(NULL), _size(0), _capacity(0), _mapped(false) {}
+
+    RelocVector(const RelocVector&) = delete;
+    RelocVector& operator= (const RelocVector&) = delete;
+
+    ~RelocVector()
+    {
+        if (_mapped)
+            munmap(_data, RoundToPages(_capacity * sizeof(T)));
+        else
+            free(_data);
+    }
+
+    void push_back(const T& value)
+    {
+        if (_size == _capacity)
+            Grow(_size + 1);
+        _data[_size++] = value;
+    }
+
+    void reserve(size_t n)
+    {
+        if (n > _capacity)
+            Grow(n);
+    }
+
+    T& operator[] (size_t i) { return _data[i]; }
+    const T& operator[] (size_t i) const { return _data[i]; }
+
+    T* data() { return _data; }
+    size_t size() const { return _size; }
+    size_t capacity() const { return _capacity; }
+    bool mapped() const { return _mapped; }
+};
+
+template <typename Vector>
+double FillMs(Vector& v, size_t n)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < n; ++i)
+        v.push_back((int) i);
+    auto stopTime = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(stopTime - startTime).count();
+}
+
+int main()
+{
+                        /* small growth: realloc like the p2 example */
+    RelocVector<int> small;
+    small.push_back(1);
+    small.push_back(2);
+    cout << "small: size " << small.size() << " capacity " << small.capacity()
+         << " mapped " << small.mapped() << std::endl;
+
+                        /* large growth compared to std::vector */
+    const size_t N = 64 * 1024 * 1024;   // 256 MB of int
+
+    std::vector<int> vec;
+    double vecMs = FillMs(vec, N);
+
+    RelocVector<int> reloc;
+    double relocMs = FillMs(reloc, N);
+
+    bool same = true;
+    for (size_t i = 0; i < N; i += 4096)
+        same = same && vec[i] == reloc[i];
+
+    cout << "std::vector push_back " << N << " ints: " << vecMs << " ms" << std::endl;
+    cout << "RelocVector push_back " << N << " ints: " << relocMs << " ms"
+         << " (mapped " << reloc.mapped() << ", same data " << same << ")" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,284 @@
+/*
+- Problem: the same expensive object (a board read by ReadBoardFile of intro.cpp, a pizza built by
+           the builder of Design patterns.cpp) is built again and again, while an identical copy built
+           earlier is still alive somewhere else in the program.
+
+- Weak pointer cache: std::weak_ptr (memory_mng.cpp) observes an object without owning it.
+                      the cache keeps a weak_ptr per key:
+                      > hit : the object is still owned by someone, weak_ptr::lock () gives
+                              a new shared_ptr to the same object, nothing is built.
+                      > miss: nobody owns it anymore (or it was never built), the factory
+                              builds a new one and the cache remembers it.
+                      the cache never keeps an object alive by itself, when the last shared_ptr
+                      goes away the object is destroyed as usual.
+
+- Sharded locking: the keys are spread over several shards (hash of the key), every shard has
+                   its own mutex and map, so threads asking for different keys rarely wait
+                   for each other.
+                   the factory runs without holding the lock. if two threads miss the same key
+                   at the same time both build it, the first one stored wins and the second
+                   one gets the first object (its own copy is dropped).
+
+- Sweeping: an expired weak_ptr still takes a map entry (and its control block), so every
+            SweepEvery inserts the shard erases its expired entries, Sweep () does it for all
+            the shards.
+            NB: the objects are created with shared_ptr<T> (new T), not make_shared: with
+                make_shared the object and the control block are one allocation, which is
+                freed only when the last weak_ptr is gone, so the cache would keep the memory
+                of dead objects until the next sweep.
+
+- To build: g++ -std=c++17 -O2 -pthread memory_weak_cache.cpp
+*/
+
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <filesystem>
+#include <fstream>
+#include "board.h"
+#include "pizza_builder.h"
+
+using std::cout;
+
+template <typename Key, typename T, typename Hash = std::hash<Key>>
+class WeakCache
+{
+    public:
+    explicit WeakCache(size_t shards = 16, size_t sweepEvery = 1024)
+        : _shards(shards), _sweepEvery(sweepEvery), _hits(0), _misses(0), _swept(0) {}
+
+    WeakCache(const WeakCache&) = delete;
+    WeakCache& operator= (const WeakCache&) = delete;
+
+    // returns the live object of key, or builds one with factory () (which returns a T)
+    template <typename Factory>
+    std::shared_ptr<T> GetOrCreate(const Key& key, Factory factory)
+    {
+        Shard& shard = ShardOf(key);
+        {
+            std::lock_guard<std::mutex> lock(shard.m);
+            auto it = shard.map.find(key);
+            if (it != shard.map.end())
+            {
+                if (std::shared_ptr<T> alive = it->second.lock())
+                {
+                    _hits.fetch_add(1, std::memory_order_relaxed);
+                    return alive;
+                }
+            }
+        }
+
+        // build without the lock, other keys of the shard are not blocked meanwhile
+        std::shared_ptr<T> built(new T(factory()));
+        _misses.fetch_add(1, std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> lock(shard.m);
+        std::weak_ptr<T>& slot = shard.map[key];
+        if (std::shared_ptr<T> other = slot.lock())
+            return other;           // another thread stored it first
+        slot = built;
+
+        if (++shard.insertsSinceSweep >= _sweepEvery)
+            SweepLocked(shard);
+        return built;
+    }
+
+    // the live object of key, nullptr if there is none (never builds)
+    std::shared_ptr<T> Find(const Key& key)
+    {
+        Shard& shard = ShardOf(key);
+        std::lock_guard<std::mutex> lock(shard.m);
+        auto it = shard.map.find(key);
+        return it == shard.map.end() ? nullptr : it->second.lock();
+    }
+
+    // erases the expired entries of all the shards
+    void Sweep()
+    {
+        for (Shard& shard : _shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.m);
+            SweepLocked(shard);
+        }
+    }
+
+    size_t Entries()
+    {
+        size_t n = 0;
+        for (Shard& shard : _shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.m);
+            n += shard.map.size();
+        }
+        return n;
+    }
+
+    long Hits() const { return _hits.load(std::memory_order_relaxed); }
+    long Misses() const { return _misses.load(std::memory_order_relaxed); }
+    long Swept() const { return _swept.load(std::memory_order_relaxed); }
+
+    private:
+    struct Shard
+    {
+        std::mutex m;
+        std::unordered_map<Key, std::weak_ptr<T>, Hash> map;
+        size_t insertsSinceSweep = 0;
+    };
+
+    Shard& ShardOf(const Key& key)
+    {
+        return _shards[Hash()(key) % _shards.size()];
+    }
+
+    void SweepLocked(Shard& shard)
+    {
+        long erased = 0;
+        for (auto it = shard.map.begin(); it != shard.map.end();)
+        {
+            if (it->second.expired())
+            {
+                it = shard.map.erase(it);
+                ++erased;
+            }
+            else
+                ++it;
+        }
+        shard.insertsSinceSweep = 0;
+        _swept.fetch_add(erased, std::memory_order_relaxed);
+    }
+
+    std::vector<Shard> _shards;
+    size_t _sweepEvery;
+    std::atomic<long> _hits;
+    std::atomic<long> _misses;
+    std::atomic<long> _swept;
+};
+
+                        /* Pizza built by the Cook of Design patterns.cpp (pizza_builder.h) */
+Pizza BuildPizza(const std::string& recipe)
+{
+    Cook cook;
+    HawaiianPizzaBuilder hawaiian;
+    SpicyPizzaBuilder spicy;
+    PizzaBuilder& builder = recipe == "hawaiian" ? (PizzaBuilder&) hawaiian : (PizzaBuilder&) spicy;
+    cook.makePizza(builder);
+    return builder.getPizza();
+}
+
+                        /* Board read by ReadBoardFile of intro.cpp (board.h), the expensive object */
+typedef std::vector<std::vector<int>> Board;
+
+// writes a rows x cols board file "0,1,0,..." generated from id, returns its path
+std::string WriteBoardFile(const std::filesystem::path& dir, int id, int rows, int cols)
+{
+    std::string path = (dir / ("board" + std::to_string(id) + ".board")).string();
+    std::ofstream file(path);
+    unsigned seed = id * 2654435761u;
+    for (int i = 0; i < rows; ++i)
+    {
+        for (int j = 0; j < cols; ++j)
+        {
+            seed = seed * 1103515245u + 12345u;
+            file << ((seed >> 16) % 4 == 0 ? 1 : 0) << ',';
+        }
+        file << '\n';
+    }
+    return path;
+}
+
+long Walls(const Board& board)
+{
+    long walls = 0;
+    for (const std::vector<int>& row : board)
+        for (int cell : row)
+            walls += cell;
+    return walls;
+}
+
+double Ms(std::chrono::high_resolution_clock::time_point from)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - from).count();
+}
+
+int main()
+{
+                        /* pizzas: same recipe while one is alive, same object */
+    WeakCache<std::string, Pizza> pizzas;
+    {
+        std::shared_ptr<Pizza> p1 = pizzas.GetOrCreate("hawaiian", [] { return BuildPizza("hawaiian"); });
+        std::shared_ptr<Pizza> p2 = pizzas.GetOrCreate("hawaiian", [] { return BuildPizza("hawaiian"); });
+        p1->displayPizza();
+        cout << "same pizza object: " << (p1 == p2) << std::endl;
+    }
+    // p1 and p2 are gone, the pizza is destroyed, the next request builds a new one
+    cout << "after the owners are gone, cached: " << (pizzas.Find("hawaiian") != nullptr) << std::endl;
+
+                        /* boards: several threads ask for a small set of boards */
+    const int Boards = 32;
+    const int Requests = 2000;
+    unsigned threads = std::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 4;
+
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "weak_cache_boards";
+    std::filesystem::create_directories(dir);
+    std::vector<std::string> paths;
+    for (int id = 0; id < Boards; ++id)
+        paths.push_back(WriteBoardFile(dir, id, 64, 64));
+
+    // keyed by the file path
+    WeakCache<std::string, Board> boards(16, 64);
+
+    // some boards are held by a "game" for the whole run, the others come and go
+    std::vector<std::shared_ptr<Board>> held;
+    for (int id = 0; id < Boards; id += 2)
+        held.push_back(boards.GetOrCreate(paths[id], [&paths, id] { return ReadBoardFile(paths[id]); }));
+
+    auto run = [&](bool useCache) {
+        std::atomic<long> walls(0);
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t)
+            workers.emplace_back([&, t] {
+                long sum = 0;
+                for (int i = 0; i < Requests; ++i)
+                {
+                    const std::string& path = paths[(i * 7 + t) % Boards];
+                    std::shared_ptr<Board> b = useCache
+                        ? boards.GetOrCreate(path, [&path] { return ReadBoardFile(path); })
+                        : std::shared_ptr<Board>(new Board(ReadBoardFile(path)));
+                    sum += Walls(*b);
+                }
+                walls += sum;
+            });
+        for (std::thread& w : workers)
+            w.join();
+        return walls.load();
+    };
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+    long plain = run(false);
+    double plainMs = Ms(t0);
+    t0 = std::chrono::high_resolution_clock::now();
+    long cached = run(true);
+    double cachedMs = Ms(t0);
+
+    cout << "always read the file : " << plainMs << " ms" << std::endl;
+    cout << "weak cache           : " << cachedMs << " ms (same result " << (plain == cached) << ")" << std::endl;
+    cout << "hits " << boards.Hits() << ", misses " << boards.Misses()
+         << ", expired entries swept " << boards.Swept() << std::endl;
+
+    held.clear();
+    boards.Sweep();
+    cout << "entries after the game released its boards and a sweep: " << boards.Entries() << std::endl;
+
+    std::filesystem::remove_all(dir);
+
+    return 0;
+}
@@ -0,0 +1,302 @@
+/*
+- ObjectPool<T> and PoolPtr<T>: the object pool of memory_object_pool.cpp (chunks of slots,
+                                thread local caches, lock-free free list), also used by
+                                memory_alloc_benchmark.cpp.
+
+- Raw pointers: PoolPtr::release() gives up the handle and returns the object, like
+                std::unique_ptr::release(). ObjectPool::Adopt() takes such an object back into a
+                PoolPtr, so code which keeps raw pointers (an allocator interface) can use the pool.
+*/
+
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include "thread_index.h"
+
+template <typename T> class ObjectPool;
+
+template <typename T>
+class PoolPtr
+{
+    typedef typename ObjectPool<T>::Slot Slot;
+
+    ObjectPool<T>* _pool;
+    Slot* _slot;
+
+    friend class ObjectPool<T>;
+    PoolPtr(ObjectPool<T>* pool, Slot* slot) : _pool(pool), _slot(slot) {}
+
+    public:
+    PoolPtr() : _pool(nullptr), _slot(nullptr) {}
+
+    PoolPtr(const PoolPtr&) = delete;
+    PoolPtr& operator= (const PoolPtr&) = delete;
+
+    PoolPtr(PoolPtr&& other) noexcept : _pool(other._pool), _slot(other._slot)
+    {
+        other._slot = nullptr;
+    }
+
+    PoolPtr& operator= (PoolPtr&& other) noexcept
+    {
+        std::swap(_pool, other._pool);
+        std::swap(_slot, other._slot);
+        return *this;
+    }
+
+    ~PoolPtr()
+    {
+        reset();
+    }
+
+    // give the slot back to the pool
+    void reset()
+    {
+        if (_slot != nullptr)
+            _pool->Release(_slot);
+        _slot = nullptr;
+    }
+
+    // gives up the handle without releasing the slot, the object goes back with ObjectPool::Adopt()
+    T* release()
+    {
+        T* object = get();
+        _slot = nullptr;
+        return object;
+    }
+
+    T* get() const { return _slot ? _slot->object() : nullptr; }
+    T& operator* () const { return *_slot->object(); }
+    T* operator-> () const { return _slot->object(); }
+    explicit operator bool () const { return _slot != nullptr; }
+};
+
+template <typename T>
+class ObjectPool
+{
+    public:
+    static const uint32_t ChunkSize = 1024;
+    static const uint32_t DirectorySize = 256;      // chunk pointers per directory page
+    static const uint32_t MaxChunks = DirectorySize * DirectorySize;
+    static const uint32_t LocalLimit = 256;
+
+    struct Slot
+    {
+        std::atomic<uint32_t> next;
+        Slot* localNext;
+        uint32_t index;
+        bool constructed;
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T* object() { return reinterpret_cast<T*>(storage); }
+    };
+
+    explicit ObjectPool(bool keepConstructed = false)
+        : _keepConstructed(keepConstructed), _head(Pack(0, Empty)), _chunkCount(0)
+    {
+        for (uint32_t i = 0; i < DirectorySize; ++i)
+            _directory[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator= (const ObjectPool&) = delete;
+
+    // all the handles must be released before the pool is destroyed
+    ~ObjectPool()
+    {
+        uint32_t count = _chunkCount.load();
+        for (uint32_t c = 0; c < count; ++c)
+        {
+            Slot* chunk = Chunk(c);
+            for (uint32_t i = 0; i < ChunkSize; ++i)
+            {
+                if (chunk[i].constructed)
+                    chunk[i].object()->~T();
+                chunk[i].~Slot();
+            }
+            ::operator delete (chunk);
+        }
+        for (uint32_t d = 0; d < DirectorySize; ++d)
+            delete[] _directory[d].load();
+    }
+
+    // constructs a new object, or with keepConstructed hands out a released one as it is
+    template <typename... Args>
+    PoolPtr<T> Acquire(Args&&... args)
+    {
+        Slot* s = nullptr;
+        int t = ThreadIndex::Get();
+        if (t < ThreadIndex::Max && _local[t].head != nullptr)
+        {
+            LocalCache& cache = _local[t];
+            s = cache.head;
+            cache.head = s->localNext;
+            --cache.count;
+        }
+        else
+            s = Pop();
+
+        if (!s->constructed)
+        {
+            try
+            {
+                new (s->storage) T(std::forward<Args>(args)...);
+            }
+            catch (...)
+            {
+                Push(s);
+                throw;
+            }
+            s->constructed = true;
+        }
+        return PoolPtr<T>(this, s);
+    }
+
+    // takes back an object given out by PoolPtr::release()
+    PoolPtr<T> Adopt(T* object)
+    {
+        Slot* s = reinterpret_cast<Slot*>(reinterpret_cast<unsigned char*>(object) - offsetof(Slot, storage));
+        return PoolPtr<T>(this, s);
+    }
+
+    private:
+    friend class PoolPtr<T>;
+
+    static const uint32_t Empty = 0xFFFFFFFFu;
+
+    static uint64_t Pack(uint32_t tag, uint32_t index) { return ((uint64_t) tag << 32) | index; }
+    static uint32_t Tag(uint64_t head) { return (uint32_t) (head >> 32); }
+    static uint32_t Index(uint64_t head) { return (uint32_t) head; }
+
+    Slot* Chunk(uint32_t c)
+    {
+        return _directory[c / DirectorySize].load(std::memory_order_acquire)[c % DirectorySize]
+                   .load(std::memory_order_acquire);
+    }
+
+    Slot* At(uint32_t index)
+    {
+        return &Chunk(index / ChunkSize)[index % ChunkSize];
+    }
+
+    void Release(Slot* s)
+    {
+        if (!_keepConstructed)
+        {
+            s->object()->~T();
+            s->constructed = false;
+        }
+
+        int t = ThreadIndex::Get();
+        if (t >= ThreadIndex::Max)
+        {
+            Push(s);
+            return;
+        }
+
+        LocalCache& cache = _local[t];
+        s->localNext = cache.head;
+        cache.head = s;
+        if (++cache.count > LocalLimit)
+        {
+            // give half of the cache back to the shared free list
+            while (cache.count > LocalLimit / 2)
+            {
+                Slot* back = cache.head;
+                cache.head = back->localNext;
+                --cache.count;
+                Push(back);
+            }
+        }
+    }
+
+    void Push(Slot* s)
+    {
+        uint64_t head = _head.load(std::memory_order_relaxed);
+        do
+        {
+            s->next.store(Index(head), std::memory_order_relaxed);
+        } while (!_head.compare_exchange_weak(head, Pack(Tag(head) + 1, s->index),
+                                              std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    Slot* Pop()
+    {
+        uint64_t head = _head.load(std::memory_order_acquire);
+        for (;;)
+        {
+            if (Index(head) == Empty)
+            {
+                AddChunk();
+                head = _head.load(std::memory_order_acquire);
+                continue;
+            }
+            // the slot may be popped by another thread meanwhile, then the tag changed and the CAS fails
+            Slot* s = At(Index(head));
+            uint32_t next = s->next.load(std::memory_order_relaxed);
+            if (_head.compare_exchange_weak(head, Pack(Tag(head) + 1, next),
+                                            std::memory_order_acquire, std::memory_order_acquire))
+                return s;
+        }
+    }
+
+    // slow path: only one thread adds a chunk, the others find the new free slots
+    void AddChunk()
+    {
+        std::lock_guard<std::mutex> lock(_growMutex);
+        if (Index(_head.load(std::memory_order_acquire)) != Empty)
+            return;
+
+        uint32_t c = _chunkCount.load(std::memory_order_relaxed);
+        if (c == MaxChunks)
+            throw std::bad_alloc();
+
+        // a directory page is added for every DirectorySize chunks, pages are never moved or freed
+        // before the pool, so At() reads them without the mutex
+        std::atomic<Slot*>* page = _directory[c / DirectorySize].load(std::memory_order_relaxed);
+        if (page == nullptr)
+        {
+            page = new std::atomic<Slot*>[DirectorySize];
+            for (uint32_t i = 0; i < DirectorySize; ++i)
+                page[i].store(nullptr, std::memory_order_relaxed);
+            _directory[c / DirectorySize].store(page, std::memory_order_release);
+        }
+
+        Slot* chunk = static_cast<Slot*>(::operator new (sizeof(Slot) * ChunkSize));
+        for (uint32_t i = 0; i < ChunkSize; ++i)
+        {
+            new (&chunk[i]) Slot();
+            chunk[i].localNext = nullptr;
+            chunk[i].index = c * ChunkSize + i;
+            chunk[i].constructed = false;
+        }
+        page[c % DirectorySize].store(chunk, std::memory_order_release);
+        _chunkCount.store(c + 1, std::memory_order_release);
+
+        for (uint32_t i = 0; i < ChunkSize; ++i)
+            Push(&chunk[i]);
+    }
+
+    struct alignas(64) LocalCache
+    {
+        Slot* head = nullptr;
+        uint32_t count = 0;
+    };
+
+    bool _keepConstructed;
+    LocalCache _local[ThreadIndex::Max];
+    alignas(64) std::atomic<uint64_t> _head;
+    // two levels: directory pages of chunk pointers are allocated as the pool grows,
+    // so an empty pool is small (the pool is often a local variable)
+    std::atomic<std::atomic<Slot*>*> _directory[DirectorySize];
+    std::atomic<uint32_t> _chunkCount;
+    std::mutex _growMutex;
+};
+
+#endif
@@ -0,0 +1,291 @@
+/*
+- offset_ptr<T> and PersistentHeap: the file backed heap of memory_persistent_heap.cpp (mmap with
+                                    MAP_SHARED, named roots, first fit free list), a
+                                    std::pmr::memory_resource. also used by memory_alloc_benchmark.cpp.
+*/
+
+#ifndef PERSISTENT_HEAP_H
+#define PERSISTENT_HEAP_H
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <memory_resource>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+                            /* offset pointer */
+template <typename T>
+class offset_ptr
+{
+    // distance from this object to the target, 1 means null (an object never points inside itself)
+    ptrdiff_t _off;
+
+    void Set(const T* p)
+    {
+        _off = p ? (const char*) p - (const char*) this : 1;
+    }
+
+    public:
+    offset_ptr(T* p = nullptr) { Set(p); }
+    offset_ptr(const offset_ptr& other) { Set(other.get()); }
+
+    offset_ptr& operator= (const offset_ptr& other)
+    {
+        Set(other.get());
+        return *this;
+    }
+
+    offset_ptr& operator= (T* p)
+    {
+        Set(p);
+        return *this;
+    }
+
+    T* get() const { return _off == 1 ? nullptr : (T*) ((const char*) this + _off); }
+    T& operator* () const { return *get(); }
+    T* operator-> () const { return get(); }
+    T& operator[] (size_t i) const { return get()[i]; }
+    explicit operator bool () const { return _off != 1; }
+};
+
+                            /* Persistent heap */
+class PersistentHeap : public std::pmr::memory_resource
+{
+    public:
+    static const int MaxRoots = 32;
+
+    PersistentHeap() : _fd(-1), _base(nullptr), _size(0) {}
+
+    ~PersistentHeap()
+    {
+        Close();
+    }
+
+    PersistentHeap(const PersistentHeap&) = delete;
+    PersistentHeap& operator= (const PersistentHeap&) = delete;
+
+    // opens (or creates with the given size) the heap file, returns false on error
+    // wasClean tells if the previous run closed the file properly
+    bool Open(const char* path, size_t size, bool& created, bool& wasClean)
+    {
+        _fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (_fd < 0)
+            return false;
+
+        struct stat st;
+        if (fstat(_fd, &st) != 0)
+        {
+            Abandon();
+            return false;
+        }
+        created = st.st_size == 0;
+        if (created && ftruncate(_fd, size) != 0)
+        {
+            Abandon();
+            return false;
+        }
+        _size = created ? size : (size_t) st.st_size;
+        if (_size < sizeof(Header))
+        {
+            Abandon();
+            return false;
+        }
+
+        void* p = mmap(NULL, _size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+        if (p == MAP_FAILED)
+        {
+            Abandon();
+            return false;
+        }
+        _base = (char*) p;
+
+        Header* h = Head();
+        if (created)
+        {
+            memset(h, 0, sizeof(Header));
+            h->magic = Magic;
+            h->size = _size;
+            h->top = RoundUp(sizeof(Header));
+            h->freeList = 0;
+            h->clean = 1;
+        }
+        else if (h->magic != Magic || h->size != _size)
+        {
+            // not our file: don't write anything into it
+            Abandon();
+            return false;
+        }
+
+        wasClean = h->clean == 1;
+
+        // from now on the file is being changed, a crash leaves the flag cleared
+        h->clean = 0;
+        msync(_base, PageSize(), MS_SYNC);
+        return true;
+    }
+
+    // flushes everything, then marks the file clean
+    void Close()
+    {
+        if (_base == nullptr)
+            return;
+        msync(_base, _size, MS_SYNC);
+        Head()->clean = 1;
+        msync(_base, PageSize(), MS_SYNC);
+        munmap(_base, _size);
+        close(_fd);
+        _base = nullptr;
+        _fd = -1;
+    }
+
+    void* Allocate(size_t bytes)
+    {
+        Header* h = Head();
+        size_t need = RoundUp(bytes + sizeof(Block));
+
+        // first fit in the free list
+        uint64_t* link = &h->freeList;
+        while (*link != 0)
+        {
+            Block* b = (Block*) (_base + *link);
+            if (b->size >= need)
+            {
+                *link = b->nextFree;
+                return b + 1;
+            }
+            link = &b->nextFree;
+        }
+
+        if (h->top + need > _size)
+            throw std::bad_alloc();
+        Block* b = (Block*) (_base + h->top);
+        b->size = need;
+        b->nextFree = 0;
+        h->top += need;
+        return b + 1;
+    }
+
+    void Deallocate(void* p)
+    {
+        Block* b = (Block*) p - 1;
+        b->nextFree = Head()->freeList;
+        Head()->freeList = (char*) b - _base;
+    }
+
+    // constructs a named root object, the name must be new and shorter than 32 characters
+    template <typename T, typename... Args>
+    T* Construct(const char* name, Args&&... args)
+    {
+        Header* h = Head();
+        if (strlen(name) >= sizeof(h->roots[0].name))
+            throw std::invalid_argument("root name too long");
+        if (Root<T>(name) != nullptr)
+            throw std::invalid_argument("root name already used");
+
+        for (int i = 0; i < MaxRoots; ++i)
+        {
+            if (h->roots[i].offset == 0)
+            {
+                void* memory = Allocate(sizeof(T));
+                T* object;
+                try
+                {
+                    object = new (memory) T(std::forward<Args>(args)...);
+                }
+                catch (...)
+                {
+                    Deallocate(memory);
+                    throw;
+                }
+                strcpy(h->roots[i].name, name);
+                h->roots[i].offset = (char*) object - _base;
+                return object;
+            }
+        }
+        throw std::bad_alloc();
+    }
+
+    // finds a named root object, nullptr if there is none
+    template <typename T>
+    T* Root(const char* name)
+    {
+        Header* h = Head();
+        for (int i = 0; i < MaxRoots; ++i)
+            if (h->roots[i].offset != 0 && strcmp(h->roots[i].name, name) == 0)
+                return (T*) (_base + h->roots[i].offset);
+        return nullptr;
+    }
+
+    size_t Used() const { return Head()->top; }
+
+    private:
+    static const uint64_t Magic = 0x5048454150303031ull;     // "PHEAP001"
+
+    struct RootEntry
+    {
+        char name[32];
+        uint64_t offset;
+    };
+
+    struct Header
+    {
+        uint64_t magic;
+        uint64_t size;
+        uint64_t top;
+        uint64_t freeList;
+        uint64_t clean;
+        RootEntry roots[MaxRoots];
+    };
+
+    struct Block
+    {
+        uint64_t size;
+        uint64_t nextFree;
+    };
+
+    // std::pmr interface, blocks are 16 bytes aligned
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        if (alignment > 16)
+            throw std::bad_alloc();
+        return Allocate(bytes);
+    }
+
+    void do_deallocate(void* p, size_t, size_t) override
+    {
+        Deallocate(p);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    static size_t PageSize() { return (size_t) sysconf(_SC_PAGESIZE); }
+    static size_t RoundUp(size_t n) { return (n + 15) / 16 * 16; }
+
+    Header* Head() const { return (Header*) _base; }
+
+    // releases the file without touching its content
+    void Abandon()
+    {
+        if (_base != nullptr)
+            munmap(_base, _size);
+        if (_fd >= 0)
+            close(_fd);
+        _base = nullptr;
+        _fd = -1;
+    }
+
+    int _fd;
+    char* _base;
+    size_t _size;
+};
+
+#endif
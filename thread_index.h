@@ -0,0 +1,55 @@
+/*
+- ThreadIndex: a small index per running thread (0, 1, 2 ...), used to find the thread's own
+               entry in an array (a cache in memory_object_pool.cpp, a record in memory_reclamation.cpp).
+               indices of finished threads are reused by new threads.
+               the index is not bounded: with more than Max threads alive Get() returns Max or more,
+               the caller checks it before using its array.
+*/
+
+#ifndef THREAD_INDEX_H
+#define THREAD_INDEX_H
+
+#include <mutex>
+#include <vector>
+
+class ThreadIndex
+{
+    public:
+    static const int Max = 256;
+
+    static int Get()
+    {
+        thread_local Holder holder;
+        return holder.index;
+    }
+
+    private:
+    struct Holder
+    {
+        int index;
+
+        Holder()
+        {
+            std::lock_guard<std::mutex> lock(Mutex());
+            if (!Free().empty())
+            {
+                index = Free().back();
+                Free().pop_back();
+            }
+            else
+                index = Next()++;
+        }
+
+        ~Holder()
+        {
+            std::lock_guard<std::mutex> lock(Mutex());
+            Free().push_back(index);
+        }
+    };
+
+    static std::mutex& Mutex() { static std::mutex m; return m; }
+    static std::vector<int>& Free() { static std::vector<int> v; return v; }
+    static int& Next() { static int n = 0; return n; }
+};
+
+#endif